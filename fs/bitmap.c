@@ -77,8 +77,8 @@ void free_block(int dev, int block)
 	// 逻辑块号小于第一个逻辑块号或大于逻辑块数，说明块不合法
 	if (block < sb->s_firstdatazone || block >= sb->s_nzones)
 		panic("trying to free block not in datazone");
-	// 确定将要释放的块没有程序使用
-	bh = get_hash_table(dev,block);									// 获取指定块上数据
+	// 确定将要释放的块没有程序使用（虚拟盘的块直接映射，没有缓存副本需要作废）
+	bh = (MAJOR(dev) == 1) ? NULL : get_hash_table(dev,block);		// 获取指定块上数据
 	if (bh) {
 		if (bh->b_count != 1) {										// 不允许释放正在被其他进程引用的块
 			printk("trying to free block (%04x:%d), count=%d\n",
@@ -94,7 +94,7 @@ void free_block(int dev, int block)
 		printk("block (%04x:%d) ",dev,block+sb->s_firstdatazone-1);
 		panic("free_block: bit already cleared");
 	}
-	sb->s_zmap[block/8192]->b_dirt = 1;								// 将该逻辑位图所在块设置为脏
+	mark_buffer_dirty(sb->s_zmap[block/8192]);						// 将该逻辑位图所在块设置为脏
 }
 
 /**
@@ -123,7 +123,7 @@ int new_block(int dev)
 	if (set_bit(j,bh->b_data))
 		panic("new_block: bit already set");
 	// 将该空闲块所在位图块置位脏，等待同步回块设备
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	// 更新块号
 	j += i*8192 + sb->s_firstdatazone-1;
 	if (j >= sb->s_nzones)
@@ -131,12 +131,12 @@ int new_block(int dev)
 	// 获取指定空闲块
 	if (!(bh=getblk(dev,j)))
 		panic("new_block: cannot get block");
-	if (bh->b_count != 1)
+	if (bh->b_count != 1 && !RD_BUFFER(bh))	// 虚拟盘块的缓冲头可能同时被别处引用（free_block 不再检查）
 		panic("new block: count is != 1");
 	// 清空指定块数据
 	clear_block(bh->b_data);  
 	bh->b_uptodate = 1;
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	// 释放该缓冲区
 	brelse(bh);
 	return j;
@@ -177,7 +177,7 @@ void free_inode(struct m_inode * inode)
 	// 将位图中指定 i 节点的位清 0
 	if (clear_bit(inode->i_num&8191,bh->b_data))
 		printk("free_inode: bit already cleared.\n\r");
-	bh->b_dirt = 1;
+	mark_buffer_dirty(bh);
 	// 清空 inode 所指向的内存
 	memset(inode,0,sizeof(*inode));
 }
@@ -214,7 +214,7 @@ struct m_inode * new_inode(int dev)
 	// 将i节点位图上指定位置置位，表明该i节点已被使用
 	if (set_bit(j,bh->b_data))
 		panic("new_inode: bit already set");
-	bh->b_dirt = 1; // 修改位图所在缓冲区置位已修改，等待同步写回设备
+	mark_buffer_dirty(bh); // 修改位图所在缓冲区置位已修改，等待同步写回设备
 	// 设置新建 i 节点参数
 	inode->i_count=1;
 	inode->i_nlinks=1;
@@ -11,6 +11,10 @@
 #include <asm/segment.h>
 #include <asm/system.h>
 
+#define MIN(a,b) (((a)<(b))?(a):(b))
+
+#define DIRECT_BLOCKS (PAGE_SIZE/BLOCK_SIZE) 	// 直接读写时每次传输的最多块数（一页）
+
 /**
  * 数据块写函数-向指定设备从指定偏移处写入指定长度数组
  * @param dev 设备号
@@ -19,7 +23,7 @@
  * @param count 要传送的字节数
  * @return 写入的字节数
 */
-int block_write(int dev, long * pos, char * buf, int count)
+int block_write(int dev, off_t * pos, char * buf, int count)
 {
 	int block = *pos >> BLOCK_SIZE_BITS; 				// 获取 pos 所在块号
 	int offset = *pos & (BLOCK_SIZE-1);					// 获取 pos 在 block 上的偏移值
@@ -32,9 +36,11 @@ int block_write(int dev, long * pos, char * buf, int count)
 		chars = BLOCK_SIZE - offset;					// chars 表示当前块剩余可写的空间数
 		if (chars > count)								// 剩余空间大于 count 时，表示当前块可以写完，将 chars 设置为剩余未写字节数
 			chars=count;
-		if (chars == BLOCK_SIZE)						// 正好需要写一块数据，则直接申请一块高速缓冲区
+		if (chars == BLOCK_SIZE) {						// 正好需要写一块数据，则直接申请一块高速缓冲区
+			get_fs_byte(buf);							// 先让用户页面调入内存，从取得缓冲块到置为有效之间不再睡眠
+			get_fs_byte(buf+BLOCK_SIZE-1);
 			bh = getblk(dev,block);
-		else
+		} else
 			bh = breada(dev,block,block+1,block+2,-1);	// 否则则需要读入将被修改的数据块，并预读两块数据块
 		block++;										// 块号 +1
 		if (!bh)										// 缓冲区读取失败，返回已写的字符数
@@ -46,7 +52,8 @@ int block_write(int dev, long * pos, char * buf, int count)
 		count -= chars;									// 需要写的字符数减去将要写的字符数
 		while (chars-->0)								// 将字符复制到缓冲区中指定位置
 			*(p++) = get_fs_byte(buf++);
-		bh->b_dirt = 1;									// 将更新后的缓冲区写回盘
+		bh->b_uptodate = 1;								// 整块写入或已读入后修改，缓冲区内容均有效
+		mark_buffer_dirty(bh);							// 将更新后的缓冲区写回盘
 		brelse(bh);
 	}
 	return written;
@@ -54,14 +61,17 @@ int block_write(int dev, long * pos, char * buf, int count)
 
 /**
  * 数据块读函数-读取指定设备的指定偏移处指定长度字符
+ * 预读与 file_read 相同：从上次读结束处继续读时预读窗口加倍（最多 RA_MAX 块），否则减半直至关闭；
+ * 读到已预读范围的后半部分时才提交下一窗口，而不是每读一块都重新检查后面的块
  * @param dev 设备号
- * @param pos 设备文件中的偏移指针
+ * @param filp 文件对象（读写偏移与预读状态）
  * @param buf 用户地址空间中缓冲区地址
  * @param count 要传送的字节数
  * @return 读取的字节数
 */
-int block_read(int dev, unsigned long * pos, char * buf, int count)
+int block_read(int dev, struct file * filp, char * buf, int count)
 {
+	unsigned long * pos = (unsigned long *) &filp->f_pos;
 	int block = *pos >> BLOCK_SIZE_BITS;					// 计算 pos 所在块号
 	int offset = *pos & (BLOCK_SIZE-1);						// 计算 pos 在 block 上的偏移值
 	int chars;
@@ -69,12 +79,26 @@ int block_read(int dev, unsigned long * pos, char * buf, int count)
 	struct buffer_head * bh;
 	register char * p;
 
+	if (block == filp->f_ra_next)							// 顺序读，扩大预读窗口
+		filp->f_ra_win = filp->f_ra_win ? MIN(filp->f_ra_win*2, RA_MAX) : RA_MIN;
+	else {													// 随机读，缩小预读窗口并重新开始计算预读范围
+		filp->f_ra_win >>= 1;
+		if (filp->f_ra_win < RA_MIN)
+			filp->f_ra_win = 0;
+		filp->f_ra_end = 0;
+	}
 	while (count>0) {
 		chars = BLOCK_SIZE-offset;							// chars 表示当前块剩余可读字符数
 		if (chars > count)									// 剩余空间大于 count 时，表示会将当前块读完，将 chars 设置为剩余未读字节数
 			chars = count;
-		if (!(bh = breada(dev,block,block+1,block+2,-1)))	// 读入将被读取的数据块，并预读两块数据块
-			return read?read:-EIO;
+		if (filp->f_ra_win && block + filp->f_ra_win/2 >= filp->f_ra_end) {	// 进入预读范围的后半部分，提交下一窗口的预读
+			if (filp->f_ra_end <= block)
+				filp->f_ra_end = block+1;
+			prefetch_range(dev,filp->f_ra_end,block+1+filp->f_ra_win-filp->f_ra_end);
+			filp->f_ra_end = block+1+filp->f_ra_win;
+		}
+		if (!(bh = bread(dev,block)))						// 读入将被读取的数据块
+			break;
 		block++;											// 块号 +1
 		p = offset + bh->b_data;							// p 指针指向要读的开始位置
 		offset = 0;
@@ -85,5 +109,109 @@ int block_read(int dev, unsigned long * pos, char * buf, int count)
 			put_fs_byte(*(p++),buf++);
 		brelse(bh);											// 释放缓冲区
 	}
-	return read;
+	filp->f_ra_next = *pos >> BLOCK_SIZE_BITS;				// 记录下一次顺序读应开始的块
+	return read?read:-EIO;
+}
+
+/**
+ * 把内核内存中的数据复制到用户空间（先按长字复制）
+ * @param to 用户空间地址
+ * @param from 内核地址
+ * @param n 字节数
+*/
+static void copy_to_user(char * to, char * from, int n)
+{
+	for ( ; n >= 4 ; n -= 4, from += 4, to += 4)
+		put_fs_long(*(unsigned long *) from,(unsigned long *) to);
+	while (n-- > 0)
+		put_fs_byte(*(from++),to++);
+}
+
+/**
+ * 把用户空间的数据复制到内核内存（先按长字复制）
+ * @param to 内核地址
+ * @param from 用户空间地址
+ * @param n 字节数
+*/
+static void copy_from_user(char * to, char * from, int n)
+{
+	for ( ; n >= 4 ; n -= 4, from += 4, to += 4)
+		*(unsigned long *) to = get_fs_long((unsigned long *) from);
+	while (n-- > 0)
+		*(to++) = get_fs_byte(from++);
+}
+
+/**
+ * 直接（不经过高速缓冲区）读块设备：每次最多读一页到临时页面，再复制给用户
+ * @param dev 设备号
+ * @param pos 设备文件中的偏移指针
+ * @param buf 用户地址空间中缓冲区地址
+ * @param count 要传送的字节数
+ * @return 读取的字节数
+*/
+int block_read_direct(int dev, off_t * pos, char * buf, int count)
+{
+	int block, offset, chars;
+	int read = 0;
+	char * page;
+
+	if (!(page = (char *) get_free_page()))
+		return -ENOMEM;
+	while (count>0) {
+		block = *pos >> BLOCK_SIZE_BITS;
+		offset = *pos & (BLOCK_SIZE-1);
+		chars = DIRECT_BLOCKS*BLOCK_SIZE - offset;
+		if (chars > count)
+			chars = count;
+		if (direct_io(READ,dev,block,page,
+		    (offset+chars+BLOCK_SIZE-1) >> BLOCK_SIZE_BITS))
+			break;
+		copy_to_user(buf,page+offset,chars);
+		*pos += chars;
+		buf += chars;
+		read += chars;
+		count -= chars;
+	}
+	free_page((unsigned long) page);
+	return read?read:-EIO;
+}
+
+/**
+ * 直接（不经过高速缓冲区）写块设备：每次最多写一页；首尾不是整块时先读入该块，保留不被覆盖的部分
+ * @param dev 设备号
+ * @param pos 设备文件中的偏移指针
+ * @param buf 用户地址空间中缓冲区地址
+ * @param count 要传送的字节数
+ * @return 写入的字节数
+*/
+int block_write_direct(int dev, off_t * pos, char * buf, int count)
+{
+	int block, offset, chars, n;
+	int written = 0;
+	char * page;
+
+	if (!(page = (char *) get_free_page()))
+		return -ENOMEM;
+	while (count>0) {
+		block = *pos >> BLOCK_SIZE_BITS;
+		offset = *pos & (BLOCK_SIZE-1);
+		chars = DIRECT_BLOCKS*BLOCK_SIZE - offset;
+		if (chars > count)
+			chars = count;
+		n = (offset+chars+BLOCK_SIZE-1) >> BLOCK_SIZE_BITS;
+		if (offset && direct_io(READ,dev,block,page,1))
+			break;
+		if (((offset+chars) & (BLOCK_SIZE-1)) && (n > 1 || !offset) &&
+		    direct_io(READ,dev,block+n-1,page+(n-1)*BLOCK_SIZE,1))
+			break;
+		copy_from_user(page+offset,buf,chars);
+		if (direct_io(WRITE,dev,block,page,n))
+			break;
+		*pos += chars;
+		buf += chars;
+		written += chars;
+		count -= chars;
+	}
+	free_page((unsigned long) page);
+	return written?written:-EIO;
 }
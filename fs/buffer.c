@@ -19,48 +19,319 @@
  */
 
 #include <stdarg.h>
+#include <errno.h>
  
 #include <linux/config.h>
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <asm/system.h>
 #include <asm/io.h>
+#include <asm/segment.h>
 
 extern int end; 													// 由链接程序 ld 生成的指向程序末端的变量-
 struct buffer_head * start_buffer = (struct buffer_head *) &end;	
-struct buffer_head * hash_table[NR_HASH]; 							// 存储已使用的块的hash表
-static struct buffer_head * free_list; 								// 空闲链表头指针
+struct buffer_head ** hash_table; 									// 存储已使用的块的hash表，在 buffer_init 中按缓冲块数分配
+static int nr_hash = 0;												// hash 表项数（2 的幂）
+static int hash_bits = 0;											// hash 表项数所占的比特位数
+static unsigned long hash_lookups = 0, hash_probes = 0;				// hash 查找次数与查找时比较过的缓冲块总数
+static struct buffer_head * lru_list[3] = {NULL, NULL, NULL};		// 试用/保护/脏 LRU 链表头指针（表头为最久未使用，表尾为最近使用）
+static int nr_lru[3] = {0, 0, 0};									// 各 LRU 表中的缓冲块数
+static struct {
+	unsigned long hits, misses;
+} buffer_stat[NR_BH_CLASS];											// 各类缓冲块的命中/未命中次数
 static struct task_struct * buffer_wait = NULL;						// 等待缓冲区使用完的解锁的指针
 int NR_BUFFERS = 0;													// 高速缓冲区中，缓冲块个数
 
+/*
+ * Tunables of the dirty-buffer flusher, readable and writable through
+ * sys_bdflush(). The thresholds are percentages of NR_BUFFERS, and the
+ * soft one may not be set above the hard one.
+ */
+static long bdf_prm[4] = {5*HZ, 30*HZ, 40, 60};
+#define bdf_interval	bdf_prm[0]	// 刷写进程定时唤醒间隔（滴答）
+#define bdf_age			bdf_prm[1]	// 脏块存在超过该时间（滴答）后被写回
+#define bdf_soft		bdf_prm[2]	// 脏块超过该比例时立即唤醒刷写进程，并写回全部脏块
+#define bdf_hard		bdf_prm[3]	// 脏块超过该比例时写进程需等待刷写进程
+
+static struct task_struct * bdflush_task = NULL;					// 刷写进程
+static struct task_struct * bdflush_wait = NULL;					// 刷写进程在此睡眠等待唤醒
+static struct task_struct * bdflush_done = NULL;					// 被限速的写进程在此等待刷写完成
+static int bdflush_timer_on = 0;									// 刷写定时器是否已设置
+
 /**
  * 等待指定缓冲区解锁
  * @param bh 需要被等待缓冲区的头指针
 */
 static inline void wait_on_buffer(struct buffer_head * bh)
 {
+	if (bh->b_lock) 			// 要等待时先开始处理被塞住的块设备请求队列
+		unplug_devices();
 	cli(); 						// 关闭中断
 	while (bh->b_lock) 			// 如果已被上锁，进程进行睡眠，等待其解锁
 		sleep_on(&bh->b_wait);
 	sti(); 						// 开启中断
 }
 
+/*
+ * Multiplicative hashing: the product with a constant close to 2^32/phi
+ * mixes all the bits of (dev,block) into its top bits, so runs of
+ * consecutive blocks on several devices still spread over the whole
+ * table. nr_hash is a power of two sized from NR_BUFFERS in buffer_init().
+ */
+#define _hashfn(dev,block) \
+	((((unsigned)(dev)<<16 ^ (unsigned)(block)) * 0x9E370001UL) >> (32-hash_bits))	// 对指定 dev 与 block 进行hash
+#define hash(dev,block) hash_table[_hashfn(dev,block)] 			// 查找指定 dev 与 block 在hash表中所在的项
+
+/*
+ * The LRU lists only hold buffers nobody is using (b_count == 0):
+ * getblk() takes its victim from the head of a clean list, so a
+ * cache miss costs the same however many buffers there are. A buffer
+ * leaves its list when it gets referenced, and brelse() puts it back
+ * at the tail (most recently used end) of the list it belongs to.
+ *
+ * Clean buffers are split 2Q-style: a freshly read block sits on the
+ * probation list, and only moves to the protected list once it is
+ * found in the cache again (or if it is metadata, see bread_class()).
+ * As long as the probation list is above its target size victims come
+ * from there, so one big sequential read only recycles its own blocks.
+ */
+#define PROBATION_TARGET (NR_BUFFERS/4)	// 试用表目标长度（缓冲块总数的 1/4）
+
 /**
- * 将所有i节点与缓冲同步到存储设备
+ * 将缓冲块从所在 LRU 表中摘除
+ * @param bh 缓冲块指针
 */
-int sys_sync(void)
+static inline void remove_from_lru(struct buffer_head * bh)
+{
+	if (bh->b_list == BUF_NONE)
+		return;
+	if (!(bh->b_prev_free) || !(bh->b_next_free))
+		panic("Free block list corrupted");
+	// 该块是表中唯一一项时，表置空；否则从循环链表中摘除
+	if (bh->b_next_free == bh)
+		lru_list[bh->b_list] = NULL;
+	else {
+		bh->b_prev_free->b_next_free = bh->b_next_free;
+		bh->b_next_free->b_prev_free = bh->b_prev_free;
+		if (lru_list[bh->b_list] == bh)
+			lru_list[bh->b_list] = bh->b_next_free;
+	}
+	nr_lru[bh->b_list]--;
+	bh->b_prev_free = bh->b_next_free = NULL;
+	bh->b_list = BUF_NONE;
+}
+
+/**
+ * 将缓冲块放入对应 LRU 表尾（最近使用端）：脏块进脏表，被再次引用过的干净块进保护表，其余进试用表
+ * 数据无效且未在读的块没有保留价值，直接放到试用表头，下次优先被替换
+ * @param bh 缓冲块指针
+*/
+static inline void insert_into_lru(struct buffer_head * bh)
+{
+	struct buffer_head ** list;
+
+	if (bh->b_dirt)
+		bh->b_list = BUF_DIRTY;
+	else if (bh->b_refs > 1 && bh->b_uptodate)
+		bh->b_list = BUF_PROTECTED;
+	else
+		bh->b_list = BUF_PROBATION;
+	list = lru_list + bh->b_list;
+	nr_lru[bh->b_list]++;
+	if (!*list) {
+		*list = bh->b_prev_free = bh->b_next_free = bh;
+		return;
+	}
+	bh->b_next_free = *list;
+	bh->b_prev_free = (*list)->b_prev_free;
+	(*list)->b_prev_free->b_next_free = bh;
+	(*list)->b_prev_free = bh;
+	if (!bh->b_uptodate && !bh->b_lock && !bh->b_dirt)
+		*list = bh;
+}
+
+/**
+ * 选出可被替换的缓冲块（只看表头，不遍历）
+ * 试用表超过目标长度或保护表为空时从试用表头淘汰，否则从保护表头淘汰；都为空时才取脏表头
+ * @return 被选中的缓冲块，全部缓冲块都在使用时返回 NULL
+*/
+static inline struct buffer_head * lru_victim(void)
+{
+	if (lru_list[BUF_PROBATION] &&
+	    (nr_lru[BUF_PROBATION] > PROBATION_TARGET || !lru_list[BUF_PROTECTED]))
+		return lru_list[BUF_PROBATION];
+	if (lru_list[BUF_PROTECTED])
+		return lru_list[BUF_PROTECTED];
+	return lru_list[BUF_DIRTY];
+}
+
+/*
+ * Every buffer that has a device is also kept on a per-device list,
+ * and every dirty one on a per-device dirty list, so that sync_dev()
+ * and invalidate_buffers() only look at the buffers of that device
+ * instead of the whole cache. The lists are hashed on the device
+ * number, so walkers still have to check b_dev.
+ *
+ * The dirty lists are cleaned lazily: a buffer that has been written
+ * out stays on its list until the next walk drops it.
+ */
+#define NR_DEV_HASH 16
+#define _devhashfn(dev) ((MAJOR(dev)*7+MINOR(dev))%NR_DEV_HASH)	// 对设备号进行 hash
+
+static struct buffer_head * dev_list[NR_DEV_HASH];				// 各设备缓冲块表（以 NULL 结尾的双向链表）
+static struct buffer_head * dirty_list[NR_DEV_HASH];			// 各设备脏块表（双向循环链表，表头最早置脏）
+static int nr_dirty[NR_DEV_HASH];								// 各设备脏块表中的缓冲块数
+
+/**
+ * 将缓冲块从所在设备脏块表中摘除
+ * @param bh 缓冲块指针
+*/
+static inline void remove_from_dirty(struct buffer_head * bh)
 {
 	int i;
+
+	if (!bh->b_next_dirty)
+		return;
+	i = _devhashfn(bh->b_dev);
+	if (bh->b_next_dirty == bh)
+		dirty_list[i] = NULL;
+	else {
+		bh->b_prev_dirty->b_next_dirty = bh->b_next_dirty;
+		bh->b_next_dirty->b_prev_dirty = bh->b_prev_dirty;
+		if (dirty_list[i] == bh)
+			dirty_list[i] = bh->b_next_dirty;
+	}
+	nr_dirty[i]--;
+	bh->b_prev_dirty = bh->b_next_dirty = NULL;
+}
+
+/**
+ * 将缓冲块放入所在设备脏块表尾，已在表中时不做处理
+ * @param bh 缓冲块指针
+*/
+static inline void insert_into_dirty(struct buffer_head * bh)
+{
+	struct buffer_head ** list;
+
+	if (bh->b_next_dirty || !bh->b_dev)
+		return;
+	list = dirty_list + _devhashfn(bh->b_dev);
+	nr_dirty[_devhashfn(bh->b_dev)]++;
+	if (!*list) {
+		*list = bh->b_prev_dirty = bh->b_next_dirty = bh;
+		return;
+	}
+	bh->b_next_dirty = *list;
+	bh->b_prev_dirty = (*list)->b_prev_dirty;
+	(*list)->b_prev_dirty->b_next_dirty = bh;
+	(*list)->b_prev_dirty = bh;
+}
+
+/**
+ * 将缓冲块置为已修改，并挂入所在设备的脏块表；修改缓冲块数据后应调用本函数而不是直接设置 b_dirt
+ * @param bh 缓冲块指针
+*/
+void mark_buffer_dirty(struct buffer_head * bh)
+{
+	if (RD_BUFFER(bh))							// 直接映射虚拟盘内存的块修改后即已 "写回"
+		return;
+	if (!bh->b_dirt) {
+		bh->b_dirt = 1;
+		bh->b_dirtime = jiffies ? jiffies : 1;	// 记录置脏时间，刷写进程据此判断脏块存在时间
+	}
+	insert_into_dirty(bh);
+}
+
+/*
+ * Write clustering: dirty buffers are collected NR_CLUSTER at a time,
+ * sorted by device and block number and only then handed to
+ * ll_rw_block(), so runs of adjacent blocks reach the request queue in
+ * order and get merged into multi-sector requests.
+ */
+#define NR_CLUSTER 32	// 一次收集排序后写回的最大缓冲块数
+
+/**
+ * 按设备号、块号排序后依次提交一组缓冲块的写请求，不等待写完；
+ * 调用者已为每块增加引用计数，提交后在此释放
+ * @param list 缓冲块指针数组
+ * @param n 缓冲块数
+ * @return 提交了写请求的块数
+*/
+static int write_cluster(struct buffer_head ** list, int n)
+{
 	struct buffer_head * bh;
+	int i, j, sent = 0;
 
-	sync_inodes();		/* write out inodes into buffers */
-	bh = start_buffer;
-	// 将所有脏块写回块设备
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		wait_on_buffer(bh);
+	// 插入排序
+	for (i=1 ; i<n ; i++) {
+		bh = list[i];
+		for (j=i ; j>0 && (list[j-1]->b_dev > bh->b_dev ||
+		    (list[j-1]->b_dev == bh->b_dev && list[j-1]->b_blocknr > bh->b_blocknr)) ; j--)
+			list[j] = list[j-1];
+		list[j] = bh;
+	}
+	for (i=0 ; i<n ; i++) {
+		bh = list[i];
 		if (bh->b_dirt)
 			ll_rw_block(WRITE,bh);
+		if (bh->b_dirt)					// 未能提交写请求时放回脏块表
+			insert_into_dirty(bh);
+		else
+			sent++;
 	}
+	for (i=0 ; i<n ; i++)
+		if (!--list[i]->b_count)
+			insert_into_lru(list[i]);
+	if (n)
+		wake_up(&buffer_wait);
+	return sent;
+}
+
+/**
+ * 写回一个设备脏块表中属于指定设备的脏块
+ * 每次只从表头取一块，已写回的块直接摘除，其他设备的块移到表尾；收集到的脏块成批排序后写回
+ * @param i 设备脏块表序号
+ * @param dev 设备号，为 0 时写回表中全部脏块
+*/
+static void sync_dirty_list(int i, int dev)
+{
+	struct buffer_head * bh, * list[NR_CLUSTER];
+	int n = nr_dirty[i], k = 0;
+
+	while (n-- > 0 && (bh = dirty_list[i])) {
+		remove_from_dirty(bh);
+		if (!bh->b_dirt)
+			continue;
+		if (dev && bh->b_dev != dev) {
+			insert_into_dirty(bh);
+			continue;
+		}
+		if (!bh->b_count++)				// 写期间占用该块，防止被 getblk 替换
+			remove_from_lru(bh);
+		list[k++] = bh;
+		if (k == NR_CLUSTER) {
+			write_cluster(list,k);
+			k = 0;
+		}
+	}
+	write_cluster(list,k);
+}
+
+/**
+ * 将所有i节点与缓冲同步到存储设备
+*/
+int sys_sync(void)
+{
+	int i;
+
+	sync_inodes();		/* write out inodes into buffers */
+	// 将所有设备脏块表中的脏块写回块设备
+	for (i=0 ; i<NR_DEV_HASH ; i++)
+		sync_dirty_list(i,0);
+	// 最后让已安装的设备把写缓存写到盘片上（同一硬盘只有第一次刷新需要真正执行）
+	for (i=0 ; i<NR_SUPER ; i++)
+		if (super_block[i].s_dev)
+			ll_rw_flush(super_block[i].s_dev);
 	return 0;
 }
 
@@ -71,28 +342,11 @@ int sys_sync(void)
 */
 int sync_dev(int dev)
 {
-	int i;
-	struct buffer_head * bh;
-
-	bh = start_buffer;
-	// 遍历所有缓冲，写回所有与指定设备号匹配的缓冲
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		if (bh->b_dev != dev)
-			continue;
-		wait_on_buffer(bh);		// 等待匹配缓冲区解锁
-		// 将脏块写回块设备
-		if (bh->b_dev == dev && bh->b_dirt)
-			ll_rw_block(WRITE,bh);
-	}
+	// 只遍历该设备的脏块表，写回所有与指定设备号匹配的脏块
+	sync_dirty_list(_devhashfn(dev),dev);
 	sync_inodes();				// 将 i 节点数据同步回块设备
-	bh = start_buffer;			// 重新遍历写回脏块
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
-		if (bh->b_dev != dev)
-			continue;
-		wait_on_buffer(bh);
-		if (bh->b_dev == dev && bh->b_dirt)
-			ll_rw_block(WRITE,bh);
-	}
+	sync_dirty_list(_devhashfn(dev),dev);	// 重新遍历写回脏块
+	ll_rw_flush(dev);			// 让设备把写缓存写到盘片上
 	return 0;
 }
 
@@ -102,17 +356,18 @@ int sync_dev(int dev)
 */
 void inline invalidate_buffers(int dev)
 {
-	int i;
 	struct buffer_head * bh;
 
-	bh = start_buffer;
-	// 遍历缓冲区头节点数组，将所有相关缓冲 更新标志与已修改标志置为 0 
-	for (i=0 ; i<NR_BUFFERS ; i++,bh++) {
+repeat:
+	// 遍历该设备的缓冲块表，将所有相关缓冲 更新标志与已修改标志置为 0；等待解锁时表可能被改动，需重新遍历
+	for (bh = dev_list[_devhashfn(dev)] ; bh ; bh = bh->b_next_dev) {
 		if (bh->b_dev != dev)
 			continue;
-		wait_on_buffer(bh);
-		if (bh->b_dev == dev)
-			bh->b_uptodate = bh->b_dirt = 0;
+		if (bh->b_lock) {
+			wait_on_buffer(bh);
+			goto repeat;
+		}
+		bh->b_uptodate = bh->b_dirt = 0;
 	}
 }
 
@@ -150,11 +405,8 @@ void check_disk_change(int dev)
 	invalidate_buffers(dev); 				// 使数据占用的缓冲区失效
 }
 
-#define _hashfn(dev,block) (((unsigned)(dev^block))%NR_HASH) 	// 对指定 dev 与 block 进行hash
-#define hash(dev,block) hash_table[_hashfn(dev,block)] 			// 查找指定 dev 与 block 在hash表中所在的项
-
 /**
- * 从 hash 队列和空闲缓冲队列中移走指定缓冲块
+ * 从 hash 队列、设备表和 LRU 表中移走指定缓冲块
  * @param bh 将要移除的缓冲块指针
 */
 static inline void remove_from_queues(struct buffer_head * bh)
@@ -167,37 +419,42 @@ static inline void remove_from_queues(struct buffer_head * bh)
 		bh->b_prev->b_next = bh->b_next;
 	if (hash(bh->b_dev,bh->b_blocknr) == bh)
 		hash(bh->b_dev,bh->b_blocknr) = bh->b_next;
-/* remove from free list */
-	// 将该缓冲块从空闲列表中移除
-	if (!(bh->b_prev_free) || !(bh->b_next_free))
-		panic("Free block list corrupted");
-	bh->b_prev_free->b_next_free = bh->b_next_free;
-	bh->b_next_free->b_prev_free = bh->b_prev_free;
-	if (free_list == bh)
-		free_list = bh->b_next_free;
+	// 将该缓冲块从设备缓冲块表和脏块表中移除
+	if (bh->b_next_dev)
+		bh->b_next_dev->b_prev_dev = bh->b_prev_dev;
+	if (bh->b_prev_dev)
+		bh->b_prev_dev->b_next_dev = bh->b_next_dev;
+	if (bh->b_dev && dev_list[_devhashfn(bh->b_dev)] == bh)
+		dev_list[_devhashfn(bh->b_dev)] = bh->b_next_dev;
+	remove_from_dirty(bh);
+/* remove from lru list */
+	remove_from_lru(bh);
 }
 
 /**
- * 将指定缓冲区放到空闲缓冲区尾并放入hash_table中
+ * 将指定缓冲区放入 hash_table 与设备缓冲块表中；
+ * 缓冲块此时已被 getblk 引用，要等 brelse 时才放回 LRU 表
  * @param bh 将要插入的缓冲块指针
 */
 static inline void insert_into_queues(struct buffer_head * bh)
 {
-/* put at end of free list */
-	// 将该缓冲块插入到空闲列表中末尾
-	bh->b_next_free = free_list;
-	bh->b_prev_free = free_list->b_prev_free;
-	free_list->b_prev_free->b_next_free = bh;
-	free_list->b_prev_free = bh;
 /* put the buffer in new hash-queue if it has a device */
 	// 将该缓冲块加入到哈西表
 	bh->b_prev = NULL;
 	bh->b_next = NULL;
+	bh->b_prev_dev = NULL;
+	bh->b_next_dev = NULL;
 	if (!bh->b_dev)
 		return;
 	bh->b_next = hash(bh->b_dev,bh->b_blocknr);
 	hash(bh->b_dev,bh->b_blocknr) = bh;
-	bh->b_next->b_prev = bh;
+	if (bh->b_next)
+		bh->b_next->b_prev = bh;
+	// 加入该设备的缓冲块表头
+	bh->b_next_dev = dev_list[_devhashfn(bh->b_dev)];
+	dev_list[_devhashfn(bh->b_dev)] = bh;
+	if (bh->b_next_dev)
+		bh->b_next_dev->b_prev_dev = bh;
 }
 
 /**
@@ -210,10 +467,13 @@ static struct buffer_head * find_buffer(int dev, int block)
 {		
 	struct buffer_head * tmp;
 
+	hash_lookups++;
 	// 遍历hash 表中指定项的列表，查找指定头节点指针
-	for (tmp = hash(dev,block) ; tmp != NULL ; tmp = tmp->b_next)
+	for (tmp = hash(dev,block) ; tmp != NULL ; tmp = tmp->b_next) {
+		hash_probes++;
 		if (tmp->b_dev==dev && tmp->b_blocknr==block)
 			return tmp;
+	}
 	// 没找到返回 NULL
 	return NULL;
 }
@@ -235,15 +495,22 @@ struct buffer_head * get_hash_table(int dev, int block)
 {
 	struct buffer_head * bh;
 
+	// 虚拟盘的块直接映射，不占用高速缓冲区
+	if (MAJOR(dev) == 1 && (bh = rd_getblk(dev,block)))
+		return bh;
 	for (;;) {
 		if (!(bh=find_buffer(dev,block)))
 			return NULL; 					// 不存在返回 NULL
-		bh->b_count++; 						// 指向该缓冲区数 +1
+		if (!bh->b_count++) 				// 指向该缓冲区数 +1，被引用的块从 LRU 表中摘除
+			remove_from_lru(bh);
+		if (bh->b_refs < 2) 				// 在缓存中被再次找到，提升引用级别（达到 2 后释放时进入保护表）
+			bh->b_refs++;
 		wait_on_buffer(bh); 				// 等待该块解锁
 											// 判断该缓冲区是否还是为指定设备与快的
 		if (bh->b_dev == dev && bh->b_blocknr == block)
 			return bh;
-		bh->b_count--;
+		if (!--bh->b_count)
+			insert_into_lru(bh);
 	}
 }
 
@@ -254,7 +521,6 @@ struct buffer_head * get_hash_table(int dev, int block)
  *
  * The algoritm is changed: hopefully better, and an elusive bug removed.
  */
-#define BADNESS(bh) (((bh)->b_dirt<<1)+(bh)->b_lock)	// 同时判断缓冲区的脏与锁定标志
 /**
  * 取高速缓冲区中指定的缓冲区
  * 检查指定的缓冲区是否在高速缓冲区中。如果不在，就需要在高速缓冲区中建立一个对应的新项
@@ -264,34 +530,24 @@ struct buffer_head * get_hash_table(int dev, int block)
 */
 struct buffer_head * getblk(int dev,int block)
 {
-	struct buffer_head * tmp, * bh;
+	struct buffer_head * bh;
 
 repeat:
 	if (bh = get_hash_table(dev,block))			// 存在该高速缓冲时，直接返回该缓冲头
 		return bh;
-	tmp = free_list;							// 为指定程序获取空缓冲区块
-	do {
-		if (tmp->b_count) 						// 临时缓冲头正在被使用时跳过
-			continue;
-		// bh为空或者tmp所指缓冲头的标志（修改、锁定）权重小于bh头标志位，则让 bh 指向 tmp 缓冲区头；
-		// 该 tmp 缓冲区表明既没有被修改过，也没有被锁定，则说明已为指定设备上的块以获取到对应的高速缓冲区，退出循环
-		if (!bh || BADNESS(tmp)<BADNESS(bh)) {
-			bh = tmp;
-			if (!BADNESS(tmp))
-				break;
-		}
-/* and repeat until we find something good */
-	} while ((tmp = tmp->b_next_free) != free_list);
+	// 直接取 LRU 表头（最久未使用的干净块）；干净块都用完时才退而取脏 LRU 表头
 	// 所有缓冲区都正在被使用，则睡眠，等待有空闲的缓冲区使用
-	if (!bh) {
+	if (!(bh = lru_victim())) {
 		sleep_on(&buffer_wait);
 		goto repeat;
 	}
 	wait_on_buffer(bh); 							// 等待该缓冲区解锁
 	if (bh->b_count)								// 该缓冲区还有程序使用，重新寻找可用
 		goto repeat;
-	while (bh->b_dirt) {							// 该缓冲区被修改，需要将数据写回盘，并在此等待解锁
-		sync_dev(bh->b_dev);
+	// 干净块已全部用完，只能取脏块：唤醒刷写进程，并只写回这一块，等待其写完（不再同步整个设备）
+	while (bh->b_dirt) {
+		wake_up(&bdflush_wait);
+		ll_rw_block(WRITE,bh);
 		wait_on_buffer(bh);
 		if (bh->b_count)
 			goto repeat;
@@ -306,6 +562,8 @@ repeat:
 	bh->b_count=1;
 	bh->b_dirt=0;
 	bh->b_uptodate=0;
+	bh->b_refs=1;								// 新块只被引用过一次，释放后先进入试用表
+	bh->b_class=BH_DATA;
 	remove_from_queues(bh);
 	// 然后将寻找的缓冲区插入到新 hashtable 项中
 	bh->b_dev=dev;
@@ -322,10 +580,25 @@ void brelse(struct buffer_head * buf)
 {
 	if (!buf)
 		return;
+	if (RD_BUFFER(buf)) {
+		rd_brelse(buf);
+		return;
+	}
 	wait_on_buffer(buf); 						// 等待缓存块解锁
 	if (!(buf->b_count--)) 						// 缓冲块引用计数减一
 		panic("Trying to free free buffer");
+	if (!buf->b_count) 							// 已无人引用时放到 LRU 表尾（最近使用端）
+		insert_into_lru(buf);
 	wake_up(&buffer_wait); 						// 唤醒等待缓冲区空闲的缓存
+	if (!buf->b_dirt || !bdflush_task)
+		return;
+	// 脏块过多时唤醒刷写进程；超过上限时让写进程等待刷写进程写回一轮，以免脏块占满缓冲区
+	if (nr_lru[BUF_DIRTY]*100 > bdf_soft*NR_BUFFERS)
+		wake_up(&bdflush_wait);
+	if (nr_lru[BUF_DIRTY]*100 > bdf_hard*NR_BUFFERS && current != bdflush_task) {
+		wake_up(&bdflush_wait);
+		sleep_on(&bdflush_done);
+	}
 }
 
 /*
@@ -333,18 +606,27 @@ void brelse(struct buffer_head * buf)
  * it. It returns NULL if the block was unreadable.
  */
 /**
- * 从设备上读取指定数据块并返回含有数据的缓冲区，如果指定的块不为空则返回NULL
+ * 按指定类别从设备上读取数据块，并统计该类别的命中率；
+ * 元数据块（i 节点表、目录、间接块）首次读入即受保护，不会被大文件的顺序读挤出缓存
  * @param dev 指定驱动设备
  * @param block 指定分区
+ * @param class 缓冲块类别（BH_DATA 等）
+ * @return 含有数据的缓冲区，读取失败返回 NULL
 */
-struct buffer_head * bread(int dev,int block)
+struct buffer_head * bread_class(int dev,int block,int class)
 {
 	struct buffer_head * bh;
 
 	if (!(bh=getblk(dev,block))) 				// 获取缓冲区中指定块
 		panic("bread: getblk returned NULL\n");
-	if (bh->b_uptodate) 						// 数据已经更新过，直接返回
+	bh->b_class = class;
+	if (class != BH_DATA)
+		bh->b_refs = 2;
+	if (bh->b_uptodate) { 						// 数据已经更新过，直接返回
+		buffer_stat[class].hits++;
 		return bh;
+	}
+	buffer_stat[class].misses++;
 	ll_rw_block(READ,bh); 						// 未更新过时，添加读取请求
 	wait_on_buffer(bh); 						// 等待缓冲区解锁
 	if (bh->b_uptodate) 						// 更新成功后返回
@@ -353,6 +635,48 @@ struct buffer_head * bread(int dev,int block)
 	return NULL;
 }
 
+/**
+ * 从设备上读取指定数据块并返回含有数据的缓冲区，如果指定的块不为空则返回NULL
+ * @param dev 指定驱动设备
+ * @param block 指定分区
+*/
+struct buffer_head * bread(int dev,int block)
+{
+	return bread_class(dev,block,BH_DATA);
+}
+
+/**
+ * 打印各 LRU 表长度、hash 链长度与各类缓冲块的命中率
+*/
+void show_buffer_stat(void)
+{
+	static char * class_name[NR_BH_CLASS] = {"data","inode","dir","indirect"};
+	struct buffer_head * bh;
+	unsigned long total;
+	int i, len, used = 0, longest = 0;
+
+	printk("buffers: %d probation, %d protected, %d dirty\n\r",
+		nr_lru[BUF_PROBATION],nr_lru[BUF_PROTECTED],nr_lru[BUF_DIRTY]);
+	// 统计非空 hash 链数与最长链长度，以及平均每次查找比较的缓冲块数（乘 100）
+	for (i=0 ; i<nr_hash ; i++) {
+		for (len=0, bh=hash_table[i] ; bh ; bh=bh->b_next)
+			len++;
+		if (len)
+			used++;
+		if (len > longest)
+			longest = len;
+	}
+	total = hash_lookups ? hash_probes*100/hash_lookups : 0;
+	printk("hash: %d buckets, %d used, longest chain %d, %u.%02u probes/lookup\n\r",
+		nr_hash,used,longest,total/100,total%100);
+	for (i=0 ; i<NR_BH_CLASS ; i++) {
+		total = buffer_stat[i].hits + buffer_stat[i].misses;
+		printk("%s: %u hits, %u misses (%u%%)\n\r",class_name[i],
+			buffer_stat[i].hits,buffer_stat[i].misses,
+			total ? buffer_stat[i].hits*100/total : 0);
+	}
+}
+
 /**
  * 复制内存块
  * @param from 原地址
@@ -365,6 +689,56 @@ __asm__("cld\n\t" \
 	::"c" (BLOCK_SIZE/4),"S" (from),"D" (to) \
 	:"cx","di","si")
 
+/*
+ * Batched reads: bread_submit() gets the buffers for a whole set of
+ * blocks and queues every read before anyone waits, so add_request()
+ * can sort them all into the elevator together. The caller then
+ * bread_wait()s for each buffer in turn and uses it as soon as it is
+ * there, while the rest are still being read.
+ */
+/**
+ * 为一组数据块取得缓冲块，并一起提交全部读请求，不等待读完
+ * @param dev 设备号
+ * @param b 块号数组，块号为 0 的项对应缓冲块指针置为 NULL
+ * @param bh 返回的缓冲块指针数组（已被引用）
+ * @param n 块数
+*/
+void bread_submit(int dev,int * b,struct buffer_head ** bh,int n)
+{
+	int i;
+
+	for (i=0 ; i<n ; i++) {
+		if (!b[i]) {
+			bh[i] = NULL;
+			continue;
+		}
+		if (!(bh[i] = getblk(dev,b[i])))
+			panic("bread_submit: getblk returned NULL\n");
+		if (bh[i]->b_uptodate) {
+			buffer_stat[BH_DATA].hits++;
+			continue;
+		}
+		buffer_stat[BH_DATA].misses++;
+		ll_rw_block(READ,bh[i]);
+	}
+}
+
+/**
+ * 等待 bread_submit 提交的一个缓冲块读完
+ * @param bh 缓冲块指针，可为 NULL
+ * @return 读成功返回该缓冲块，否则释放该缓冲块并返回 NULL
+*/
+struct buffer_head * bread_wait(struct buffer_head * bh)
+{
+	if (!bh)
+		return NULL;
+	wait_on_buffer(bh);
+	if (bh->b_uptodate)
+		return bh;
+	brelse(bh);
+	return NULL;
+}
+
 /**
  * 一次将最多四个缓冲块内容读取到内存指定位置
  * @param address 保存数据内存地址
@@ -376,24 +750,145 @@ void bread_page(unsigned long address,int dev,int b[4])
 	struct buffer_head * bh[4];
 	int i;
 
-	// 将 b[4] 中指定的四个块对应的数据保存到 bh[4] 对应的缓冲区中
-	for (i=0 ; i<4 ; i++)
-		if (b[i]) {
-			if (bh[i] = getblk(dev,b[i]))
-				if (!bh[i]->b_uptodate)
-					ll_rw_block(READ,bh[i]);
-		} else
-			bh[i] = NULL;
+	// 将 b[4] 中指定的四个块一起提交读请求
+	bread_submit(dev,b,bh,4);
 	// 将 bh[i] 中的数据，按照顺序复制到指定内存地址处
 	for (i=0 ; i<4 ; i++,address += BLOCK_SIZE)
-		if (bh[i]) {
-			wait_on_buffer(bh[i]);
-			if (bh[i]->b_uptodate)
-				COPYBLK((unsigned long) bh[i]->b_data,address);
+		if (bh[i] = bread_wait(bh[i])) {
+			COPYBLK((unsigned long) bh[i]->b_data,address);
 			brelse(bh[i]);				// 释放缓冲区对应内存
 		}
 }
 
+/*
+ * Uncached I/O for O_DIRECT: the blocks are transferred between the
+ * device and the caller's kernel memory through buffer heads on the
+ * stack, which never enter the hash or LRU lists, so streaming a whole
+ * disk doesn't push everybody else's blocks out of the cache. A cached
+ * copy of one of the blocks is written back first if it is dirty, and
+ * is marked stale when the device is written behind its back.
+ */
+/**
+ * 不经过高速缓冲区，在设备与内核内存之间直接传输最多 4 个连续的块
+ * @param rw READ 或 WRITE
+ * @param dev 设备号
+ * @param block 起始块号
+ * @param addr 内核内存地址
+ * @param n 块数（不超过 4）
+ * @return 成功返回 0，出错返回 -EIO
+*/
+int direct_io(int rw,int dev,int block,char * addr,int n)
+{
+	struct buffer_head tmp[4], * bh;
+	int i, err = 0;
+
+	// 先处理缓存中的同一块：脏块写回，直接写时使其失效
+	for (i=0 ; i<n ; i++) {
+		if (!(bh = find_buffer(dev,block+i)))
+			continue;
+		if (!bh->b_count++)
+			remove_from_lru(bh);
+		wait_on_buffer(bh);
+		if (bh->b_dev == dev && bh->b_blocknr == block+i) {
+			if (bh->b_dirt) {
+				ll_rw_block(WRITE,bh);
+				wait_on_buffer(bh);
+			}
+			if (rw == WRITE)
+				bh->b_uptodate = 0;
+		}
+		if (!--bh->b_count)
+			insert_into_lru(bh);
+	}
+	// 用临时缓冲头一起提交请求（相邻块会被合并），再等待全部完成
+	for (i=0 ; i<n ; i++) {
+		bh = tmp+i;
+		bh->b_data = addr + i*BLOCK_SIZE;
+		bh->b_dev = dev;
+		bh->b_blocknr = block+i;
+		bh->b_uptodate = 0;
+		bh->b_dirt = (rw == WRITE);
+		bh->b_count = 1;
+		bh->b_lock = 0;
+		bh->b_wait = NULL;
+		bh->b_list = BUF_NONE;
+		bh->b_reqnext = NULL;
+		ll_rw_block(rw,bh);
+	}
+	for (i=0 ; i<n ; i++) {
+		wait_on_buffer(tmp+i);
+		if (!tmp[i].b_uptodate)
+			err = -EIO;
+	}
+	return err;
+}
+
+/*
+ * Read-ahead. A prefetched block is read with READA, which the driver
+ * layer drops instead of sleeping when the request table is full, and
+ * nothing waits for it: the block just sits in the cache, with its
+ * b_lock set until the read completes, for whoever bread()s it next.
+ * Blocks already cached or in flight are skipped, and prefetching stops
+ * as soon as getting a buffer would mean writing a dirty one back. The
+ * ram disk is never prefetched: its blocks are always "in memory", and
+ * its buffer heads must not go anywhere near the LRU lists.
+ */
+/**
+ * 异步预读一个数据块，不等待读完即返回
+ * @param dev 设备号
+ * @param block 块号
+*/
+static void prefetch_block(int dev,int block)
+{
+	struct buffer_head * bh;
+
+	if (MAJOR(dev) == 1)						// 虚拟盘的块直接映射，无须预读
+		return;
+	if (bh = find_buffer(dev,block))
+		if (bh->b_uptodate || bh->b_lock)		// 已在缓存中或正在读写，跳过
+			return;
+	// 不在缓存中时要取一块干净缓冲块，只剩脏块时放弃预读，以免同步写回
+	if (!bh && !lru_list[BUF_PROBATION] && !lru_list[BUF_PROTECTED])
+		return;
+	if (!(bh = getblk(dev,block)))
+		return;
+	if (bh->b_refs && bh->b_class == BH_DATA)	// 预读不算一次引用，撤销 getblk 对引用级别的提升
+		bh->b_refs--;
+	if (!bh->b_uptodate)
+		ll_rw_block(READA,bh);
+	if (!--bh->b_count) 						// 取消本次引用，放回 LRU 表
+		insert_into_lru(bh);
+}
+
+/**
+ * 异步预读一组数据块，提交全部读请求后立即返回
+ * @param dev 设备号
+ * @param b 块号数组，块号为 0 的项跳过
+ * @param n 数组项数
+*/
+void prefetch_blocks(int dev,int * b,int n)
+{
+	while (n-- > 0) {
+		if (*b)
+			prefetch_block(dev,*b);
+		b++;
+	}
+}
+
+/**
+ * 异步预读一段连续的数据块，提交全部读请求后立即返回
+ * @param dev 设备号
+ * @param first 第一块的块号
+ * @param n 块数
+*/
+void prefetch_range(int dev,int first,int n)
+{
+	if (MAJOR(dev) == 1)
+		return;
+	while (n-- > 0)
+		prefetch_block(dev,first++);
+}
+
 /*
  * Ok, breada can be used as bread, but additionally to mark other
  * blocks for reading as well. End the argument list with a negative
@@ -407,7 +902,7 @@ void bread_page(unsigned long address,int dev,int b[4])
 struct buffer_head * breada(int dev,int first, ...)
 {
 	va_list args;
-	struct buffer_head * bh, *tmp;
+	struct buffer_head * bh;
 
 	va_start(args,first); // 取可变参数表中第一个参数
 	// 获取第一个参数对应的缓冲块
@@ -416,14 +911,8 @@ struct buffer_head * breada(int dev,int first, ...)
 	if (!bh->b_uptodate)
 		ll_rw_block(READ,bh);
 	// 循环将剩余所有块预读取到缓冲之中，但不引用
-	while ((first=va_arg(args,int))>=0) {
-		tmp=getblk(dev,first);
-		if (tmp) {
-			if (!tmp->b_uptodate) // 预读取
-				ll_rw_block(READA,bh);
-			tmp->b_count--; // 取消本次引用
-		}
-	}
+	while ((first=va_arg(args,int))>=0)
+		prefetch_block(dev,first);
 	// 所有块都读取到缓冲中，等待第一块缓冲解锁
 	va_end(args);
 	wait_on_buffer(bh);
@@ -433,14 +922,106 @@ struct buffer_head * breada(int dev,int first, ...)
 	return (NULL);
 }
 
+/**
+ * 刷写定时器到时函数（在时钟中断中调用），唤醒刷写进程
+*/
+static void bdflush_timeout(void)
+{
+	bdflush_timer_on = 0;
+	wake_up(&bdflush_wait);
+}
+
+/**
+ * 写回脏 LRU 表中的缓冲块
+ * 每次只处理表头一块，因此写操作中睡眠时表被其他进程改动也没有关系；
+ * 需要写回的块成批排序后写回（写完的块移入干净表），尚未到期的脏块移到表尾
+ * @param all 为 1 时写回全部脏块，否则只写回存在时间超过 bdf_age 的脏块
+ * @return 提交了写请求的块数
+*/
+static int flush_dirty_buffers(int all)
+{
+	struct buffer_head * bh, * list[NR_CLUSTER];
+	int n = nr_lru[BUF_DIRTY], k = 0, sent = 0;
+
+	while (n-- > 0 && (bh = lru_list[BUF_DIRTY])) {
+		remove_from_lru(bh);
+		if (bh->b_dirt && (all || jiffies - bh->b_dirtime >= bdf_age)) {
+			bh->b_count++; 					// 写期间占用该块，防止被 getblk 替换
+			list[k++] = bh;
+			if (k == NR_CLUSTER) {
+				sent += write_cluster(list,k);
+				k = 0;
+			}
+			continue;
+		}
+		insert_into_lru(bh);
+	}
+	return sent + write_cluster(list,k);
+}
+
+/**
+ * 刷写进程系统调用
+ * func 为 0 时调用进程成为刷写进程，不再返回（除非收到信号）；
+ * func 为 2n+2 时读取第 n 个参数到 data 所指位置，为 2n+3 时把第 n 个参数设置为 data
+ * 参数依次为：唤醒间隔、脏块写回年龄（滴答），唤醒比例、限速比例（百分比）
+ * @param func 功能号
+ * @param data 参数值或用户空间地址
+ * @return 成功返回 0，否则返回出错号
+*/
+int sys_bdflush(int func, long data)
+{
+	int i, sent;
+
+	if (!suser())
+		return -EPERM;
+	if (func >= 2) {
+		i = (func-2) >> 1;
+		if (i >= sizeof(bdf_prm)/sizeof(bdf_prm[0]))
+			return -EINVAL;
+		if (!(func & 1)) {
+			verify_area((void *) data,4);
+			put_fs_long(bdf_prm[i],(unsigned long *) data);
+			return 0;
+		}
+		if (data <= 0 || (i >= 2 && data > 100))
+			return -EINVAL;
+		if ((i == 2 && data > bdf_hard) || (i == 3 && data < bdf_soft))	// 软上限不能高于硬上限
+			return -EINVAL;
+		bdf_prm[i] = data;
+		return 0;
+	}
+	if (func)
+		return -EINVAL;
+	if (bdflush_task)
+		return -EBUSY;
+	bdflush_task = current;
+	for (;;) {
+		sent = flush_dirty_buffers(nr_lru[BUF_DIRTY]*100 > bdf_soft*NR_BUFFERS);
+		wake_up(&bdflush_done); 				// 唤醒被限速的写进程
+		if (current->signal & ~current->blocked)
+			break;
+		// 写回一轮后脏块仍过多时立即开始下一轮，否则睡眠等待定时器或写进程唤醒；
+		// 这一轮一块也没能提交（如设备不存在）时也要睡眠，内核态不可抢占，否则会一直空转
+		if (sent && nr_lru[BUF_DIRTY]*100 > bdf_soft*NR_BUFFERS)
+			continue;
+		if (!bdflush_timer_on) {
+			bdflush_timer_on = 1;
+			add_timer(bdf_interval,&bdflush_timeout);
+		}
+		interruptible_sleep_on(&bdflush_wait);
+	}
+	bdflush_task = NULL;
+	wake_up(&bdflush_done);
+	return -EINTR;
+}
+
 /**
  * 初始化缓冲区函数
  * @param buffer_end 缓冲区尾地址
 */
 void buffer_init(long buffer_end)
 {
-	// 第一个缓冲头指向主内存开始位置
-	struct buffer_head * h = start_buffer;
+	struct buffer_head * h;
 	void * b;
 	int i;
 	// 当内存尾部小于 1 M 时，640～1Mb 为显示内存与 BIOS 使用，因此实际可使用内存高端为 640 KB
@@ -448,6 +1029,16 @@ void buffer_init(long buffer_end)
 		b = (void *) (640*1024);
 	else
 		b = (void *) buffer_end;
+	// 按可容纳的缓冲块数估算 hash 表项数（取不小于缓冲块数的 2 的幂，平均链长不超过 1），
+	// hash 表放在主内存开始位置，缓冲头紧随其后
+	i = ((long) b - (long) start_buffer) / (BLOCK_SIZE + sizeof(struct buffer_head));
+	for (hash_bits = 4 ; (1 << hash_bits) < i ; hash_bits++)
+		/* nothing */ ;
+	nr_hash = 1 << hash_bits;
+	hash_table = (struct buffer_head **) start_buffer;
+	start_buffer = (struct buffer_head *) (hash_table + nr_hash);
+	// 第一个缓冲头指向 hash 表之后
+	h = start_buffer;
 	// 循环初始化所有内存，做到每个块都有对应的缓冲头
 	while ( (b -= BLOCK_SIZE) >= ((void *) (h+1)) ) {
 		h->b_dev = 0; // 设备号
@@ -459,8 +1050,15 @@ void buffer_init(long buffer_end)
 		h->b_next = NULL; // hash 表中下一项
 		h->b_prev = NULL; // hash 表中上一项
 		h->b_data = (char *) b; // data指针指向数据块 b
-		h->b_prev_free = h-1; // 初始化时所有块都是空闲 因此直接
+		h->b_prev_free = h-1; // 初始化时所有块都是空闲 因此直接放入干净 LRU 表
 		h->b_next_free = h+1;
+		h->b_list = BUF_PROBATION;
+		h->b_refs = 0;
+		h->b_dirtime = 0;
+		h->b_class = BH_DATA;
+		h->b_prev_dev = h->b_next_dev = NULL; // 不在任何设备表中
+		h->b_prev_dirty = h->b_next_dirty = NULL;
+		h->b_reqnext = NULL; // 不在任何块设备请求中
 		h++;
 		NR_BUFFERS++; //缓冲区块数累计
 		// 当b 递减到 1 kb 时，跳过显示内存与 BIOS 所占内存
@@ -468,11 +1066,18 @@ void buffer_init(long buffer_end)
 			b = (void *) 0xA0000;
 	}
 	h--;
-	// 将空闲头第一项前一项空闲指向最后一项，最后一项下一项指向 第一项，形成空闲循环链表 
-	free_list = start_buffer; 
-	free_list->b_prev_free = h;
-	h->b_next_free = free_list;
+	// 将试用表第一项前一项指向最后一项，最后一项下一项指向 第一项，形成试用 LRU 循环链表 
+	lru_list[BUF_PROBATION] = start_buffer; 
+	lru_list[BUF_PROBATION]->b_prev_free = h;
+	h->b_next_free = lru_list[BUF_PROBATION];
+	nr_lru[BUF_PROBATION] = NR_BUFFERS;
 	// 初始化hash表所有表项为空
-	for (i=0;i<NR_HASH;i++)
+	for (i=0;i<nr_hash;i++)
 		hash_table[i]=NULL;
+	// 初始化设备缓冲块表与脏块表
+	for (i=0;i<NR_DEV_HASH;i++) {
+		dev_list[i]=NULL;
+		dirty_list[i]=NULL;
+		nr_dirty[i]=0;
+	}
 }	
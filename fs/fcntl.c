@@ -86,9 +86,9 @@ int sys_fcntl(unsigned int fd, unsigned int cmd, unsigned long arg)
 			return 0;
 		case F_GETFL:									// 获取文件标志和访问模式
 			return filp->f_flags;
-		case F_SETFL:									// 设置文件标志和访问模式（根据 arg 设置添加、非阻塞标志）
-			filp->f_flags &= ~(O_APPEND | O_NONBLOCK);
-			filp->f_flags |= arg & (O_APPEND | O_NONBLOCK);
+		case F_SETFL:									// 设置文件标志和访问模式（根据 arg 设置添加、非阻塞、直接读写标志）
+			filp->f_flags &= ~(O_APPEND | O_NONBLOCK | O_DIRECT);
+			filp->f_flags |= arg & (O_APPEND | O_NONBLOCK | O_DIRECT);
 			return 0;
 		case F_GETLK:	case F_SETLK:	case F_SETLKW:	// 未实现
 			return -1;
@@ -14,8 +14,30 @@
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+#define NR_BATCH 16		// 一次读写提交的最大块数
+
+/**
+ * 异步预读文件中从指定逻辑块开始的若干块（不超过文件末尾），提交读请求后即返回
+ * @param inode 文件 i 节点
+ * @param block 起始逻辑块号
+ * @param n 块数，不超过 RA_MAX
+*/
+static void file_readahead(struct m_inode * inode, int block, int n)
+{
+	int b[RA_MAX];
+	int i, last;
+
+	last = (inode->i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	for (i=0 ; i<n && block<last ; i++,block++)
+		b[i] = bmap(inode,block);
+	prefetch_blocks(inode->i_dev,b,i);
+}
+
 /**
  * 文件读函数-根据 i 节点和文件结构，读设备数据
+ * 每次先映射最多 NR_BATCH 个逻辑块并一起提交读请求，再依次等待各块读完并复制，使一次大的读操作只等待约一次磁盘操作。
+ * 从上次读结束处继续读时视为顺序读，预读窗口加倍（最多 RA_MAX 块）；否则视为随机读，窗口减半直至关闭。
+ * 读到已预读范围的后半部分时提交下一窗口的预读，使磁盘读与数据复制重叠进行
  * @param inode 指定文件 i 节点
  * @param filp 文件对象
  * @param buf 读取到缓冲区
@@ -24,37 +46,66 @@
 */
 int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
-	int left,chars,nr;
-	struct buffer_head * bh;
+	int left,chars,nr,block,last,i,n;
+	int b[NR_BATCH];
+	struct buffer_head * bh[NR_BATCH];
 
 	if ((left=count)<=0)									// 将 left 值设置为将要读取的字符数
 		return 0;
-	while (left) {											
-		if (nr = bmap(inode,(filp->f_pos)/BLOCK_SIZE)) {	// 获取文件偏移指针所在逻辑块
-			if (!(bh=bread(inode->i_dev,nr)))
-				break;
-		} else
-			bh = NULL;
-		nr = filp->f_pos % BLOCK_SIZE;						// 将 nr 设置为文件相对于当前块的偏移量
-		chars = MIN( BLOCK_SIZE-nr , left );				// 将 chars 设置为当前块剩余值与未读取字符数中的小值
-		filp->f_pos += chars;								// 更新文件偏移位置指针
-		left -= chars;										// 更新还未读取的字符数
-		if (bh) {											// bh 不为空时，将缓冲区 bh 中指定数据复制到 buf 缓冲区中
-			char * p = nr + bh->b_data;
-			while (chars-->0)
-				put_fs_byte(*(p++),buf++);
-			brelse(bh);
-		} else {											// bh 为空时，则在 buf 指定位置指定长度置为 0
-			while (chars-->0)
-				put_fs_byte(0,buf++);
+	if ((filp->f_pos)/BLOCK_SIZE == filp->f_ra_next)		// 顺序读，扩大预读窗口
+		filp->f_ra_win = filp->f_ra_win ? MIN(filp->f_ra_win*2, RA_MAX) : RA_MIN;
+	else {													// 随机读，缩小预读窗口并重新开始计算预读范围
+		filp->f_ra_win >>= 1;
+		if (filp->f_ra_win < RA_MIN)
+			filp->f_ra_win = 0;
+		filp->f_ra_end = 0;
+	}
+	while (left) {
+		// 计算本批要读的块数，映射全部逻辑块后一起提交读请求
+		block = (filp->f_pos)/BLOCK_SIZE;
+		n = MIN((filp->f_pos % BLOCK_SIZE + left + BLOCK_SIZE - 1)/BLOCK_SIZE, NR_BATCH);
+		for (i=0 ; i<n ; i++)
+			b[i] = bmap(inode,block+i);						// 获取逻辑块对应的设备块号，为 0 表示文件空洞
+		bread_submit(inode->i_dev,b,bh,n);
+		last = block+n-1;
+		if (filp->f_ra_win && last + filp->f_ra_win/2 >= filp->f_ra_end) {
+			if (filp->f_ra_end <= last)
+				filp->f_ra_end = last+1;
+			file_readahead(inode,filp->f_ra_end,last+1+filp->f_ra_win-filp->f_ra_end);
+			filp->f_ra_end = last+1+filp->f_ra_win;
+		}
+		// 依次等待各块读完并复制到用户缓冲区
+		for (i=0 ; i<n ; i++) {
+			if (b[i] && !(bh[i] = bread_wait(bh[i]))) {		// 读取失败时释放本批其余缓冲块并结束
+				while (++i < n)
+					brelse(bh[i]);
+				goto out;
+			}
+			nr = filp->f_pos % BLOCK_SIZE;					// 将 nr 设置为文件相对于当前块的偏移量
+			chars = MIN( BLOCK_SIZE-nr , left );			// 将 chars 设置为当前块剩余值与未读取字符数中的小值
+			filp->f_pos += chars;							// 更新文件偏移位置指针
+			left -= chars;									// 更新还未读取的字符数
+			if (bh[i]) {									// bh 不为空时，将缓冲区 bh 中指定数据复制到 buf 缓冲区中
+				char * p = nr + bh[i]->b_data;
+				while (chars-->0)
+					put_fs_byte(*(p++),buf++);
+				brelse(bh[i]);
+			} else {										// bh 为空时，则在 buf 指定位置指定长度置为 0
+				while (chars-->0)
+					put_fs_byte(0,buf++);
+			}
 		}
 	}
+out:
+	filp->f_ra_next = (filp->f_pos)/BLOCK_SIZE;				// 记录下一次顺序读应开始的块
 	inode->i_atime = CURRENT_TIME;							// 设置 i 节点访问时间
 	return (count-left)?(count-left):-ERROR;				// 返回读取字符数，读取字符数为 0 时，返回错误码
 }
 
 /**
  * 文件写函数-根据 i 节点和文件结构，将数据写到设备中
+ * 与读一样按批处理：先为最多 NR_BATCH 个逻辑块分配设备块并一起提交读请求，再依次写入各块；
+ * 整块被覆盖的块直接取缓冲块而不读盘，新分配的块已由 new_block 清零并置为有效，也不会读盘
  * @param inode 指定文件 i 节点
  * @param filp 文件对象
  * @param buf 写缓冲区
@@ -64,8 +115,9 @@ int file_read(struct m_inode * inode, struct file * filp, char * buf, int count)
 int file_write(struct m_inode * inode, struct file * filp, char * buf, int count)
 {
 	off_t pos;
-	int block,c;
-	struct buffer_head * bh;
+	int block,c,j,n,stop;
+	int b[NR_BATCH], full[NR_BATCH];
+	struct buffer_head * bh[NR_BATCH];
 	char * p;
 	int i=0;
 
@@ -73,25 +125,57 @@ int file_write(struct m_inode * inode, struct file * filp, char * buf, int count
 		pos = inode->i_size;
 	else
 		pos = filp->f_pos;									// 其他情况，pos指向文件当前偏移量
-	while (i<count) {
-		if (!(block = create_block(inode,pos/BLOCK_SIZE)))	// 获取当前偏移量所在块号
-			break;
-		if (!(bh=bread(inode->i_dev,block)))				// 将偏移量所在块号读取到 bh 缓冲区中
-			break;
-		c = pos % BLOCK_SIZE;								// 将 c 置为偏移量在当前块中的偏移值
-		p = c + bh->b_data;									// 将 p 指向 bh 中写的当前指针
-		bh->b_dirt = 1;										// 更新 bh 缓冲区脏标志
-		c = BLOCK_SIZE-c;									// 计算当前块中还能写的字符数
-		if (c > count-i) c = count-i;						// 将 c 置为当前块中还需写的字符数
-		pos += c;											// 更新 pos 偏移位到写字符的尾部
-		if (pos > inode->i_size) {							// 如果当前 pos 大于指定文件大小时，更新指定文件 i 节点的文件大小
-			inode->i_size = pos;
-			inode->i_dirt = 1;
+	stop = 0;
+	while (i<count && !stop) {
+		// 为本批涉及的逻辑块分配设备块，分配失败时只处理已分配的块
+		block = pos/BLOCK_SIZE;
+		n = MIN((pos % BLOCK_SIZE + count - i + BLOCK_SIZE - 1)/BLOCK_SIZE, NR_BATCH);
+		for (j=0 ; j<n ; j++)
+			if (!(b[j] = create_block(inode,block+j))) {	// 获取逻辑块对应的设备块号
+				n = j;
+				stop = 1;
+				break;
+			}
+		// 整块被覆盖的块不必先读入（到复制时才取缓冲块）；其余的块一起提交读请求
+		for (j=0 ; j<n ; j++) {
+			full[j] = (block+j)*BLOCK_SIZE >= pos &&
+				(block+j+1)*BLOCK_SIZE <= pos+count-i;
+			if (full[j])
+				bh[j] = NULL;
+			else
+				bread_submit(inode->i_dev,b+j,bh+j,1);
+		}
+		for (j=0 ; j<n ; j++) {
+			// 整块覆盖：从取得缓冲块到置为有效之间不能睡眠，否则其他进程的 bread 会把旧数据读到其中。
+			// 因此先让用户页面调入内存，再取缓冲块（getblk 返回时该块已解锁）
+			if (full[j]) {
+				get_fs_byte(buf);
+				get_fs_byte(buf+BLOCK_SIZE-1);
+				if (!(bh[j] = getblk(inode->i_dev,b[j])))
+					panic("file_write: getblk returned NULL\n");
+			} else if (!(bh[j] = bread_wait(bh[j]))) {		// 读取失败时释放本批其余缓冲块并结束
+				while (++j < n)
+					brelse(bh[j]);
+				stop = 1;
+				break;
+			}
+			c = pos % BLOCK_SIZE;							// 将 c 置为偏移量在当前块中的偏移值
+			p = c + bh[j]->b_data;							// 将 p 指向 bh 中写的当前指针
+			mark_buffer_dirty(bh[j]);						// 更新 bh 缓冲区脏标志
+			c = BLOCK_SIZE-c;								// 计算当前块中还能写的字符数
+			if (c > count-i) c = count-i;					// 将 c 置为当前块中还需写的字符数
+			pos += c;										// 更新 pos 偏移位到写字符的尾部
+			if (pos > inode->i_size) {						// 如果当前 pos 大于指定文件大小时，更新指定文件 i 节点的文件大小
+				inode->i_size = pos;
+				inode->i_dirt = 1;
+			}
+			i += c;											// 更新 i 为写的字符数
+			while (c-->0)
+				*(p++) = get_fs_byte(buf++);				// 循环将 buf 中的字符写到 p 指针所指向的位置
+			if (full[j])									// 整块已写入，缓冲区内容有效
+				bh[j]->b_uptodate = 1;
+			brelse(bh[j]);
 		}
-		i += c;												// 更新 i 为写的字符数
-		while (c-->0)
-			*(p++) = get_fs_byte(buf++);					// 循环将 buf 中的字符写到 p 指针所指向的位置
-		brelse(bh);
 	}
 	inode->i_mtime = CURRENT_TIME;							// 设置 i 节点修改时间
 	if (!(filp->f_flags & O_APPEND)) {						// 不是以添加的方式打开文件，更新文件当前指针指向位置
@@ -132,7 +132,7 @@ static int _bmap(struct m_inode * inode,int block,int create)
 		if (!inode->i_zone[7])
 			return 0;
 		// 将间接块 7 数据读取到缓冲中
-		if (!(bh = bread(inode->i_dev,inode->i_zone[7])))
+		if (!(bh = bread_class(inode->i_dev,inode->i_zone[7],BH_INDIRECT)))
 			return 0;
 		// 获取间接块 指向数据的指针
 		i = ((unsigned short *) (bh->b_data))[block];
@@ -140,7 +140,7 @@ static int _bmap(struct m_inode * inode,int block,int create)
 		if (create && !i)
 			if (i=new_block(inode->i_dev)) {
 				((unsigned short *) (bh->b_data))[block]=i;
-				bh->b_dirt=1;
+				mark_buffer_dirty(bh);
 			}
 		brelse(bh); // 释放指定缓冲
 		return i;
@@ -154,24 +154,24 @@ static int _bmap(struct m_inode * inode,int block,int create)
 		}
 	if (!inode->i_zone[8])
 		return 0;
-	if (!(bh=bread(inode->i_dev,inode->i_zone[8])))
+	if (!(bh=bread_class(inode->i_dev,inode->i_zone[8],BH_INDIRECT)))
 		return 0;
 	i = ((unsigned short *)bh->b_data)[block>>9];
 	if (create && !i)
 		if (i=new_block(inode->i_dev)) {
 			((unsigned short *) (bh->b_data))[block>>9]=i;
-			bh->b_dirt=1;
+			mark_buffer_dirty(bh);
 		}
 	brelse(bh);
 	if (!i)
 		return 0;
-	if (!(bh=bread(inode->i_dev,i)))
+	if (!(bh=bread_class(inode->i_dev,i,BH_INDIRECT)))
 		return 0;
 	i = ((unsigned short *)bh->b_data)[block&511];
 	if (create && !i)
 		if (i=new_block(inode->i_dev)) {
 			((unsigned short *) (bh->b_data))[block&511]=i;
-			bh->b_dirt=1;
+			mark_buffer_dirty(bh);
 		}
 	brelse(bh);
 	return i;
@@ -395,7 +395,7 @@ static void read_inode(struct m_inode * inode)
 	if (!(sb=get_super(inode->i_dev)))														// 获取该 i 节点的超级块
 		panic("trying to read inode without dev");
 	block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks + (inode->i_num-1)/INODES_PER_BLOCK;	// 该 i 节点所在的逻辑块号 = 2（启动块 + 超级块） + i 节点位图占用块数 + 逻辑块位图所占块数 + （i 节点号 - 1）/每块所含有 i 节点数 
-	if (!(bh=bread(inode->i_dev,block)))													// 读取 i 节点所在块的信息到缓冲区
+	if (!(bh=bread_class(inode->i_dev,block,BH_INODE)))										// 读取 i 节点所在块的信息到缓冲区
 		panic("unable to read i-node block");
 	*(struct d_inode *)inode = ((struct d_inode *)bh->b_data)[(inode->i_num-1)%INODES_PER_BLOCK];	// 将对应 i 节点信息复制到 inode 中
 	brelse(bh); 																					// 释放 缓冲区内存
@@ -420,10 +420,10 @@ static void write_inode(struct m_inode * inode)
 	if (!(sb=get_super(inode->i_dev)))		// 获取该 i 节点所在驱动设备的超级块，不存在时死机
 		panic("trying to write inode without device");
 	block = 2 + sb->s_imap_blocks + sb->s_zmap_blocks + (inode->i_num-1)/INODES_PER_BLOCK;	// 该 i 节点所在的逻辑块号 = 2（启动块 + 超级块） + i 节点位图占用块数 + 逻辑块位图所占块数 + （i 节点号 - 1）/每块所含有 i 节点数 
-	if (!(bh=bread(inode->i_dev,block)))	// 读取指定 i 节点所在块
+	if (!(bh=bread_class(inode->i_dev,block,BH_INODE)))	// 读取指定 i 节点所在块
 		panic("unable to read i-node block");
 	((struct d_inode *)bh->b_data)[(inode->i_num-1)%INODES_PER_BLOCK] = *(struct d_inode *)inode;	// 将指定 i 节点信息复制到逻辑块对应该 i 节点的项中
-	bh->b_dirt=1;							// 置缓冲区脏标志，而 i 节点未被修改，所以 i 节点脏标志置 0
+	mark_buffer_dirty(bh);					// 置缓冲区脏标志，而 i 节点未被修改，所以 i 节点脏标志置 0
 	inode->i_dirt=0;						
 	brelse(bh);								// 释放缓冲区内存
 	unlock_inode(inode);					// 解锁 i
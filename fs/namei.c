@@ -131,7 +131,7 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
 	if (!(block = (*dir)->i_zone[0]))
 		return NULL;
 	// 将目录节点第一个直接块数据读取到缓存中
-	if (!(bh = bread((*dir)->i_dev,block)))
+	if (!(bh = bread_class((*dir)->i_dev,block,BH_DIR)))
 		return NULL;
 	// 在目录项数据块中搜索匹配指定文件名的目录项
 	i = 0;
@@ -144,7 +144,7 @@ static struct buffer_head * find_entry(struct m_inode ** dir,
 			bh = NULL;
 			// 读入下一目录项数据块，该块不为空时将其读入缓冲中
 			if (!(block = bmap(*dir,i/DIR_ENTRIES_PER_BLOCK)) ||
-			    !(bh = bread((*dir)->i_dev,block))) {
+			    !(bh = bread_class((*dir)->i_dev,block,BH_DIR))) {
 				i += DIR_ENTRIES_PER_BLOCK;
 				continue;
 			}
@@ -225,7 +225,7 @@ static struct buffer_head * add_entry(struct m_inode * dir,
 			// 设置文件名
 			for (i=0; i < NAME_LEN ; i++)
 				de->name[i]=(i<namelen)?get_fs_byte(name+i):0;
-			bh->b_dirt = 1; 								// 将缓冲区设置为已修改
+			mark_buffer_dirty(bh);							// 将缓冲区设置为已修改
 			*res_dir = de; 									// 返回的目录项指向de
 			return bh;
 		}
@@ -410,7 +410,7 @@ int open_namei(const char * pathname, int flag, int mode,
 			return -ENOSPC;
 		}
 		de->inode = inode->i_num;							// 设置目录项的 i 节点号
-		bh->b_dirt = 1;
+		mark_buffer_dirty(bh);
 		brelse(bh);											// 将目录项写回磁盘
 		iput(dir);											// 释放文件夹
 		*res_inode = inode;									// 将新建的 i 节点返回
@@ -486,7 +486,7 @@ int sys_mknod(const char * filename, int mode, int dev)
 		return -ENOSPC;
 	}
 	de->inode = inode->i_num;								// 设置 i 节点设备号
-	bh->b_dirt = 1;											// i 节点设置为脏
+	mark_buffer_dirty(bh);									// i 节点设置为脏
 	iput(dir);
 	iput(inode);
 	brelse(bh);
@@ -553,7 +553,7 @@ int sys_mkdir(const char * pathname, int mode)
 	de->inode = dir->i_num;									// 目录项 .. 指向上一级目录（dir）
 	strcpy(de->name,"..");									// 将目录项 .. 加入本目录
 	inode->i_nlinks = 2;
-	dir_block->b_dirt = 1;									// 将新加的目录项更新到磁盘
+	mark_buffer_dirty(dir_block);							// 将新加的目录项更新到磁盘
 	brelse(dir_block);
 	inode->i_mode = I_DIRECTORY | (mode & 0777 & ~current->umask);	// 设置指定 i 节点为目录 i 节点，并将权限设置为本进程权限屏蔽位
 	inode->i_dirt = 1;										// 将 i 节点置为脏
@@ -566,7 +566,7 @@ int sys_mkdir(const char * pathname, int mode)
 		return -ENOSPC;
 	}
 	de->inode = inode->i_num;								// 设置新建目录项指向新建的目录 i 节点			
-	bh->b_dirt = 1;											// 将更新目录项的块缓冲区更新
+	mark_buffer_dirty(bh);									// 将更新目录项的块缓冲区更新
 	dir->i_nlinks++;										// 目标文件夹引用数加一
 	dir->i_dirt = 1;										// 将目标文件夹 i 节点写回盘
 	iput(dir);
@@ -693,7 +693,7 @@ int sys_rmdir(const char * name)
 	if (inode->i_nlinks != 2)							// 该 i 节点链接数不等于提示文件夹链接数有问题
 		printk("empty directory has nlink!=2 (%d)",inode->i_nlinks);
 	de->inode = 0;										// 将该目录项指向 i 节点号设置为 0
-	bh->b_dirt = 1;										// 将该目录项所属缓冲区写回盘
+	mark_buffer_dirty(bh);								// 将该目录项所属缓冲区写回盘
 	brelse(bh);
 	inode->i_nlinks=0;									// 清空 i 节点链接数
 	inode->i_dirt=1;									// 将 i 节点置为脏
@@ -758,7 +758,7 @@ int sys_unlink(const char * name)
 		inode->i_nlinks=1;
 	}
 	de->inode = 0;										// 指定目录项 i 节点为 0 
-	bh->b_dirt = 1;										// 目录项所在缓冲区置为脏
+	mark_buffer_dirty(bh);								// 目录项所在缓冲区置为脏
 	brelse(bh);	
 	inode->i_nlinks--;									// 将指定文件链接数减一
 	inode->i_dirt = 1;									// 指定文件 i 节点置为脏
@@ -823,7 +823,7 @@ int sys_link(const char * oldname, const char * newname)
 		return -ENOSPC;
 	}
 	de->inode = oldinode->i_num;					// 目录项指向旧节点
-	bh->b_dirt = 1;									// 目录项缓冲区写回盘
+	mark_buffer_dirty(bh);							// 目录项缓冲区写回盘
 	brelse(bh);
 	iput(dir);
 	oldinode->i_nlinks++;							// 链接数 + 1
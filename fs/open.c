@@ -222,6 +222,8 @@ int sys_open(const char * filename,int flag,int mode)
 	f->f_count = 1;				// 文件引用计数置为 1
 	f->f_inode = inode;			// 指向指定 i 节点
 	f->f_pos = 0;				// 初始化文件指针偏移量
+	f->f_ra_next = f->f_ra_end = 0;	// 清空预读状态
+	f->f_ra_win = 0;
 	return (fd);				// 返回文件句柄
 }
 
@@ -7,6 +7,7 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <fcntl.h>
 
 #include <linux/kernel.h>
 #include <linux/sched.h>
@@ -15,8 +16,6 @@
 extern int rw_char(int rw,int dev, char * buf, int count, off_t * pos);
 extern int read_pipe(struct m_inode * inode, char * buf, int count);
 extern int write_pipe(struct m_inode * inode, char * buf, int count);
-extern int block_read(int dev, off_t * pos, char * buf, int count);
-extern int block_write(int dev, off_t * pos, char * buf, int count);
 extern int file_read(struct m_inode * inode, struct file * filp,
 		char * buf, int count);
 extern int file_write(struct m_inode * inode, struct file * filp,
@@ -82,8 +81,10 @@ int sys_read(unsigned int fd,char * buf,int count)
 		return (file->f_mode&1)?read_pipe(inode,buf,count):-EIO;
 	if (S_ISCHR(inode->i_mode))	// 调用字节文件读取函数
 		return rw_char(READ,inode->i_zone[0],buf,count,&file->f_pos);
-	if (S_ISBLK(inode->i_mode))	// 调用块文件读取函数
-		return block_read(inode->i_zone[0],&file->f_pos,buf,count);
+	if (S_ISBLK(inode->i_mode))	// 调用块文件读取函数（O_DIRECT 时不经过高速缓冲区）
+		return (file->f_flags & O_DIRECT) ?
+			block_read_direct(inode->i_zone[0],&file->f_pos,buf,count) :
+			block_read(inode->i_zone[0],file,buf,count);
 	if (S_ISDIR(inode->i_mode) || S_ISREG(inode->i_mode)) {	// 目录文件或者常规文件
 		if (count+file->f_pos > inode->i_size)				// 将读取的字节数设置成指定读取字节数与剩余字节数之中的最小值
 			count = inode->i_size - file->f_pos;
@@ -116,8 +117,10 @@ int sys_write(unsigned int fd,char * buf,int count)
 		return (file->f_mode&2)?write_pipe(inode,buf,count):-EIO;		// 调用管道文件写函数
 	if (S_ISCHR(inode->i_mode))
 		return rw_char(WRITE,inode->i_zone[0],buf,count,&file->f_pos);	// 调用字节文件写函数
-	if (S_ISBLK(inode->i_mode))
-		return block_write(inode->i_zone[0],&file->f_pos,buf,count);	// 调用块文件写函数
+	if (S_ISBLK(inode->i_mode))											// 调用块文件写函数（O_DIRECT 时不经过高速缓冲区）
+		return (file->f_flags & O_DIRECT) ?
+			block_write_direct(inode->i_zone[0],&file->f_pos,buf,count) :
+			block_write(inode->i_zone[0],&file->f_pos,buf,count);
 	if (S_ISREG(inode->i_mode))
 		return file_write(inode,file,buf,count);						// 调用普通文件写函数
 	printk("(Write)inode->i_mode=%06o\n\r",inode->i_mode);				// 不是上述文件，则打印对应文件节点 mode 属性值，然后返回错误码
@@ -39,3 +39,21 @@ __asm__ volatile ("inb %%dx,%%al\n" \
 	"1:":"=a" (_v):"d" (port)); \
 _v; \
 })
+
+/**
+ * 硬件端口双字输出函数
+ * @param value 欲输出双字
+ * @param port 硬件端口
+*/
+#define outl(value,port) \
+__asm__ ("outl %%eax,%%dx"::"a" (value),"d" (port))
+
+/**
+ * 取硬件端口双字输入函数
+ * @param port 硬件端口
+*/
+#define inl(port) ({ \
+unsigned long _v; \
+__asm__ volatile ("inl %%dx,%%eax":"=a" (_v):"d" (port)); \
+_v; \
+})
@@ -17,6 +17,7 @@
 #define O_APPEND	02000 	// 以添加的方式打开，文件指针置位文件尾
 #define O_NONBLOCK	04000	/* not fcntl */ // 非阻塞的方式打开或者操作文件
 #define O_NDELAY	O_NONBLOCK // 非阻塞的方式打开或者操作文件 
+#define O_DIRECT	040000	// 块设备读写不经过高速缓冲区
 
 /**
  * 下面定义了 fcntl() 函数的相关命令
@@ -40,11 +40,25 @@ void buffer_init(long buffer_end); 		// 初始化缓冲函数原型
 #define Z_MAP_SLOTS 8 					// 逻辑块（区段块）位图槽数
 #define SUPER_MAGIC 0x137F 				// minix 文件系统中魔数
 
+/*
+ * A compressed ram disk image (made by tools/rdcomp) starts with this
+ * header in place of the boot block; the LZ4 block-format stream that
+ * follows it decompresses to the raw file system image. On disk the
+ * header is three 32-bit little-endian words; tools/rdcomp keeps its
+ * own copy of the layout, as it is built on the host.
+ */
+#define RD_ZMAGIC 0x5a44524c 			// 压缩虚拟盘映像魔数（"LRDZ"）
+
+struct rd_zheader {
+	unsigned long z_magic; 				// RD_ZMAGIC
+	unsigned long z_size; 				// 解压后字节数
+	unsigned long z_csize; 				// 紧随头部的压缩数据字节数
+};
+
 #define NR_OPEN 20 						// 单个进程打开文件数最大值
 #define NR_INODE 32 					// i 节点数组最大数量
 #define NR_FILE 64 						// 文件最大数
 #define NR_SUPER 8 						// 超级块最大数
-#define NR_HASH 307 					// 缓冲区头哈希表 具有307项
 #define NR_BUFFERS nr_buffers
 #define BLOCK_SIZE 1024  				// 数据块长度
 #define BLOCK_SIZE_BITS 10 				// 数据块长度所占的比特位数（4B）
@@ -66,6 +80,21 @@ __asm__("incl %0\n\tandl $4095,%0"::"m" (head))
 
 typedef char buffer_block[BLOCK_SIZE]; // 块缓冲区
 
+/*
+ * Buffer classes: metadata blocks are kept in the protected part of
+ * the cache from their first use, and hits/misses are counted per class.
+ */
+#define BH_DATA		0 					// 普通数据块
+#define BH_INODE	1 					// i 节点表块
+#define BH_DIR		2 					// 目录项块
+#define BH_INDIRECT	3 					// 间接块
+#define NR_BH_CLASS	4 					// 缓冲块类别数
+
+#define BUF_PROBATION	0	// 试用 LRU 表（只被引用过一次的干净块）
+#define BUF_PROTECTED	1	// 保护 LRU 表（被再次引用过的干净块）
+#define BUF_DIRTY		2	// 脏 LRU 表
+#define BUF_NONE		3	// 不在任何 LRU 表中（正被引用或直接映射的虚拟盘块）
+
 /**
  * 缓冲区头数据结构，程序中常用 bh 缩写
 */
@@ -80,8 +109,17 @@ struct buffer_head {
 	struct task_struct * b_wait; /*指向等待该缓冲区解锁的任务*/
 	struct buffer_head * b_prev; /*hash 队列前一块*/
 	struct buffer_head * b_next; /*hash 队列后一块*/
-	struct buffer_head * b_prev_free; /*空闲表的前一块*/
-	struct buffer_head * b_next_free; /*空闲表的后一块*/
+	struct buffer_head * b_prev_free; /*LRU 表的前一块*/
+	struct buffer_head * b_next_free; /*LRU 表的后一块*/
+	unsigned char b_list;		/* BUF_PROBATION, BUF_PROTECTED, BUF_DIRTY or BUF_NONE */ /*所在 LRU 表，未被引用的缓冲块才会挂在表中*/
+	unsigned char b_refs;		/* 0 - prefetched, 1 - used once, 2 - used again */ /*引用级别：0-仅被预读，1-被引用过一次（试用），2-被再次引用或为元数据（保护）*/
+	unsigned char b_class;		/* BH_DATA etc */ /*缓冲块类别*/
+	long b_dirtime;				/* jiffies when marked dirty */ /*被置为脏的时间，供刷写进程判断*/
+	struct buffer_head * b_prev_dev; /*设备缓冲块表的前一块*/
+	struct buffer_head * b_next_dev; /*设备缓冲块表的后一块*/
+	struct buffer_head * b_prev_dirty; /*设备脏块表的前一块*/
+	struct buffer_head * b_next_dirty; /*设备脏块表的后一块，为 NULL 表示不在表中*/
+	struct buffer_head * b_reqnext; /*同一块设备请求中的下一缓冲块*/
 };
 
 /**
@@ -123,6 +161,9 @@ struct m_inode {
 	unsigned char i_update; 		/*更新标志*/
 };
 
+#define RA_MIN 4		// 预读窗口初始块数
+#define RA_MAX 32		// 预读窗口最大块数
+
 /**
  * 文件数据结构
 */
@@ -132,6 +173,9 @@ struct file {
 	unsigned short f_count; // 引用计数
 	struct m_inode * f_inode; // 文件对应的 i 节点
 	off_t f_pos; // 文件位置（读写偏移值）
+	long f_ra_next; // 顺序读时下一次读取应开始的逻辑块号
+	long f_ra_end; // 已提交预读的最后一块之后的逻辑块号
+	unsigned short f_ra_win; // 预读窗口大小（块数），为 0 时不预读（普通文件与块设备文件都使用）
 };
 
 /**
@@ -207,15 +251,34 @@ extern struct m_inode * get_pipe_inode(void);
 extern struct buffer_head * get_hash_table(int dev, int block);
 extern struct buffer_head * getblk(int dev, int block);
 extern void ll_rw_block(int rw, struct buffer_head * bh);
+extern void ll_rw_flush(int dev);
+extern struct buffer_head * rd_buffers;
+extern int nr_rd_buffers;
+extern struct buffer_head * rd_getblk(int dev,int block);
+extern void rd_brelse(struct buffer_head * bh);
+#define RD_BUFFER(bh) ((bh) >= rd_buffers && (bh) < rd_buffers + nr_rd_buffers) // 是否为直接映射虚拟盘内存的缓冲块
+extern void unplug_devices(void);
 extern void brelse(struct buffer_head * buf);
+extern void mark_buffer_dirty(struct buffer_head * bh);
 extern struct buffer_head * bread(int dev,int block);
+extern struct buffer_head * bread_class(int dev,int block,int class);
 extern void bread_page(unsigned long addr,int dev,int b[4]);
+extern int direct_io(int rw,int dev,int block,char * addr,int n);
+extern int block_read(int dev, struct file * filp, char * buf, int count);
+extern int block_write(int dev, off_t * pos, char * buf, int count);
+extern int block_read_direct(int dev, off_t * pos, char * buf, int count);
+extern int block_write_direct(int dev, off_t * pos, char * buf, int count);
+extern void bread_submit(int dev,int * b,struct buffer_head ** bh,int n);
+extern struct buffer_head * bread_wait(struct buffer_head * bh);
 extern struct buffer_head * breada(int dev,int block,...);
+extern void prefetch_blocks(int dev,int * b,int n);
+extern void prefetch_range(int dev,int first,int n);
 extern int new_block(int dev);
 extern void free_block(int dev, int block);
 extern struct m_inode * new_inode(int dev);
 extern void free_inode(struct m_inode * inode);
 extern int sync_dev(int dev);
+extern void show_buffer_stat(void);
 extern struct super_block * get_super(int dev);
 extern int ROOT_DEV; // 启动引导时的根文件系统设备号
 
@@ -20,6 +20,10 @@
 
 #define HD_CMD		0x3f6       // 控制寄存器端口
 
+/* Bit in HD_CURRENT selecting linear (LBA) addressing */
+#define HD_LBA		0x40        // 驱动号/磁头寄存器中的 LBA 寻址位（此时磁头号为 LBA 地址的 24-27 位）
+#define LBA_MAX		0x10000000  // LBA28 可寻址的扇区数上限
+
 // 硬盘状态寄存器各位的定义
 #define ERR_STAT	0x01        // 命令执行错误
 #define INDEX_STAT	0x02        // 收到索引
@@ -40,6 +44,28 @@
 #define WIN_SEEK 		0x70    // 寻道
 #define WIN_DIAGNOSE    0x90    // 控制器诊断
 #define WIN_SPECIFY		0x91    // 建立驱动器参数
+#define WIN_READDMA		0xC8    // DMA 方式读扇区
+#define WIN_WRITEDMA	0xCA    // DMA 方式写扇区
+#define WIN_MULTREAD	0xC4    // 多扇区读（每次中断传输一组扇区）
+#define WIN_MULTWRITE	0xC5    // 多扇区写
+#define WIN_SETMULT		0xC6    // 设置多扇区模式每组扇区数
+#define WIN_FLUSH		0xE7    // 把驱动器写缓存写到盘片上
+#define WIN_IDENTIFY	0xEC    // 读取驱动器识别信息（256 字）
+
+/* Words of the IDENTIFY DEVICE data used by the driver */
+#define ID_MULT		47          // 低字节：多扇区读写每组扇区数上限
+#define ID_CAPAB	49          // 能力字：位 9 表示支持 LBA，位 8 表示支持 DMA
+#define ID_LBA_LO	60          // 60-61：LBA 模式可寻址的扇区总数
+#define ID_LBA_HI	61
+
+/* Bus-master IDE registers, offsets from the base in PCI BAR4 */
+#define BM_COMMAND	0           // 命令寄存器：位 0-启动，位 3-写内存（读盘）
+#define BM_STATUS	2           // 状态寄存器：位 0-正在传输，位 1-出错，位 2-中断（写 1 清除）
+#define BM_PRDT		4           // 物理区域描述符表（PRD）地址
+#define BM_START	0x01
+#define BM_READ		0x08
+#define BM_ERR		0x02
+#define BM_INTR		0x04
 
 // 错误寄存器各比特位含义，执行控制器命令时含义与其他命令时时不同的，格式 诊断命令时（其他命令时）
 #define MARK_ERR	0x01	// 无错误（数据标志丢失）
@@ -111,6 +111,7 @@ struct task_struct {
 	long alarm; /*报警定时器*/
 	long utime,stime,cutime,cstime,start_time; /*用户态运行时间、系统态运行时间、子进程用户态运行时间、子进程系统态运行时间与开始时间*/
 	unsigned short used_math; /*是否运行协处理器标识符*/
+	unsigned short ioprio; /*I/O 优先级，高 8 位为类别，低 8 位为类别中的级别*/
 /* file system info */
 	int tty;		/* -1 if no tty, so it must be signed */ /*进程使用 tty 子设备号，-1表示未使用*/
 	unsigned short umask; /*文件创建属性屏蔽位*/
@@ -125,6 +126,22 @@ struct task_struct {
 	struct tss_struct tss; /*进程任务状态段信息结构*/
 };
 
+/*
+ * I/O priority classes, as set by sys_ioprio(). Requests of a class are
+ * always dispatched before requests of a lower class; idle-class
+ * requests only go out when nothing else is queued on the device.
+ * Within the real-time and best-effort classes, level 0 is the most
+ * urgent and IOPRIO_NORM the default.
+ */
+#define IOPRIO_CLASS_RT		1		// 实时类别
+#define IOPRIO_CLASS_BE		2		// 尽力而为类别（默认）
+#define IOPRIO_CLASS_IDLE	3		// 空闲类别
+#define IOPRIO_NR_LEVELS	8		// 每个类别的级别数（0 最高）
+#define IOPRIO_NORM			4		// 默认级别
+#define IOPRIO(class,level) (((class)<<8)|(level))	// 由类别与级别组成 I/O 优先级
+#define IOPRIO_CLASS(prio) ((prio)>>8)				// 取 I/O 优先级类别
+#define IOPRIO_LEVEL(prio) ((prio)&0xff)			// 取 I/O 优先级级别
+
 /*
  *  INIT_TASK is used to set up the first task table, touch at
  * your own risk!. Base=0, limit=0x9ffff (=640kB)
@@ -140,6 +157,7 @@ struct task_struct {
 /* uid etc */	0,0,0,0,0,0, \
 /* alarm */	0,0,0,0,0,0, \
 /* math */	0, \
+/* ioprio */	IOPRIO(IOPRIO_CLASS_BE,IOPRIO_NORM), \
 /* fs info */	-1,0022,NULL,NULL,NULL,0, \
 /* filp */	{NULL,}, \
 	{ \
@@ -137,6 +137,9 @@
 #define __NR_ssetmask	69
 #define __NR_setreuid	70
 #define __NR_setregid	71
+#define __NR_bdflush	72
+#define __NR_iosched	73
+#define __NR_ioprio		74
 
 /**
  * 不带参数的系统调用嵌入式汇编函数
@@ -290,5 +293,7 @@ int dup2(int oldfd, int newfd);
 int getppid(void);
 pid_t getpgrp(void);
 pid_t setsid(void);
+int iosched(int major, int func, long data);
+int ioprio(int pid, int prio);
 
 #endif
@@ -40,6 +40,7 @@ static inline _syscall0(int,fork)
 static inline _syscall0(int,pause) // int pause() 系统调用：暂停进程的执行，直到收到一个信号
 static inline _syscall1(int,setup,void *,BIOS) // int setup(void * BIOS) 系统调用
 static inline _syscall0(int,sync) // int sync() 系统调用
+static inline _syscall2(int,bdflush,int,func,long,data) // int bdflush(int func, long data) 系统调用
 
 #include <linux/tty.h> // tty 头文件，定义了有关 tty_io, 串行通信方面的参数、常数
 #include <linux/sched.h> // 调度程序头文件，定义了任务结构 task_strucy、第一个初始任务的数据，还有一些以宏的形式定义的有关描述符参数设置和获取的嵌入式汇编函数程序；
@@ -244,6 +245,12 @@ void init(void)
 		NR_BUFFERS*BLOCK_SIZE);
 	// 打印当前主内存空闲字节数
 	printf("Free mem: %d bytes\n\r",memory_end-main_memory_start);
+	// 创建脏缓冲块刷写进程：子进程关闭所有句柄并脱离终端会话后，进入 bdflush 在内核中循环，定时写回过期的脏块
+	if (!(pid=fork())) {
+		close(0);close(1);close(2);
+		setsid();
+		_exit(bdflush(0,0));
+	}
 	// 下面 fork() 用于创建一个子进程，该子进程关闭了句柄 0（stdin），以只读方式打开 /etc/rc 文件，并执行 /bin/sh 程序，所带参数和环境变量分别由 arg_rc 和 envp_rc 数组给出
 	if (!(pid=fork())) {
 		close(0); // 子进程关闭文件 0
@@ -4,16 +4,36 @@
 // 设置块设备数量
 #define NR_BLK_DEV	7 // 块设备数量(块设置数组长度)
 /*
- * NR_REQUEST is the number of entries in the request-queue.
- * NOTE that writes may use only the low 2/3 of these: reads
- * take precedence.
+ * Every device has its own pool of requests, allocated in blk_dev_init()
+ * with the sizes below, and its own wait list for free ones, so a burst
+ * of floppy writes can no longer take the requests the hard disk needs.
+ * NOTE that writes may use only 2/3 of a pool: reads take precedence.
  *
- * 32 seems to be a reasonable number: enough to get some benefit
- * from the elevator-mechanism, but not so much as to lock a lot of
- * buffers when they are in the queue. 64 seems to be too many (easily
- * long pauses in reading when heavy writing/syncing is going on)
+ * 32 seems to be a reasonable number for the hard disk: enough to get
+ * some benefit from the elevator-mechanism, but not so much as to lock
+ * a lot of buffers when they are in the queue. 64 seems to be too many
+ * (easily long pauses in reading when heavy writing/syncing is going on)
  */
-#define NR_REQUEST	32 // 默认块设备请求数量（写操作放置在前 2/3 ，读操作放置在后 1/3）
+#define NR_REQUEST_RD	8	// 虚拟盘请求项数
+#define NR_REQUEST_FD	16	// 软盘请求项数
+#define NR_REQUEST_HD	32	// 硬盘请求项数（写操作只能使用其中 2/3）
+
+/*
+ * Requests for adjacent blocks of the same device are merged, up to
+ * MAX_SECTORS sectors. A merged request carries a chain of buffer heads
+ * (through b_reqnext, in sector order): req->bh is the buffer being
+ * transferred, and req->buffer points into its data.
+ */
+#define MAX_SECTORS	64 // 合并后一个请求最多包含的扇区数
+
+/*
+ * Drives with a write cache may report a write done before the data is
+ * on the platters. A REQ_FLUSH request carries no data: it is a barrier
+ * that stays behind every request queued before it, and it completes
+ * once the drive has written back its cache. Only drivers that set
+ * blk_dev[].flush ever see it.
+ */
+#define REQ_FLUSH	1	// 刷新驱动器写缓存（无数据的屏障请求）
 
 /*
  * Ok, this is an expanded form so that we can use the same
@@ -29,12 +49,18 @@
 struct request {
 	int dev;					// 使用的设备号（硬盘为分区号）
 	int cmd;					// 命令 (read 或 write)
+	int flags;					// REQ_FLUSH 标志
 	int errors; 				// 操作时产生的异常
 	unsigned long sector; 		// 起始扇区
 	unsigned long nr_sectors; 	// 读/写扇区数
 	char * buffer; 				// 数据缓冲区
 	struct task_struct * waiting; // 指向任务等待执行完成的地方
-	struct buffer_head * bh; 	// 缓冲区头指针
+	struct buffer_head * bh; 	// 缓冲区头指针（合并请求中为正在传输的缓冲块，其后各块由 b_reqnext 相连）
+	struct buffer_head * bhtail; // 合并请求中最后一个缓冲块
+	unsigned short ioprio;		// 提交请求的进程的 I/O 优先级
+	long expires;				// 死线调度：请求的到期时间（滴答）
+	struct request * fifo_prev;	// 本设备同方向请求 FIFO 中的前一项
+	struct request * fifo_next;	// 本设备同方向请求 FIFO 中的后一项
 	struct request * next; 		// 指向下一请求项
 };
 
@@ -46,17 +72,44 @@ struct request {
 ((s1)->dev < (s2)->dev || ((s1)->dev == (s2)->dev && \
 (s1)->sector < (s2)->sector)))
 
+/*
+ * The deadline scheduler keeps the IN_ORDER elevator for the queue, but
+ * also keeps every queued request on a FIFO per direction. When a
+ * request completes, the oldest read whose expiry time has passed (or
+ * else the oldest expired write) is dispatched first, so a read cannot
+ * be starved forever by a stream of writes at lower sectors. It is
+ * selected and tuned per device through sys_iosched().
+ */
+#define SCHED_ELEVATOR	0	// 电梯调度（只按 IN_ORDER 排序）
+#define SCHED_DEADLINE	1	// 死线调度（IN_ORDER 排序，超时的请求优先）
+
+#define IO_CLASS(req) IOPRIO_CLASS((req)->ioprio)	// 请求的 I/O 优先级类别
+
 /**
  * 块存储设备结构
 */
+/*
+ * A queue that was empty is "plugged" when a request arrives: the
+ * driver is only started by unplug_devices(), at the next clock tick or
+ * as soon as someone waits for a buffer, so that the requests submitted
+ * in between can still be merged and sorted, the first one included.
+ */
 struct blk_dev_struct {
 	void (*request_fn)(void);			// 请求操作的函数指针
 	struct request * current_request; 	// 请求信息结构
+	struct request * free_request;		// 本设备空闲请求项链表
+	int nr_free;						// 本设备空闲请求项数
+	int nr_requests;					// 本设备请求项总数
+	struct task_struct * wait_for_request;	// 等待本设备空闲请求项的任务
+	int plugged;						// 队列被塞住（驱动程序尚未开始处理队首请求）
+	int sched;							// 调度算法，SCHED_ELEVATOR 或 SCHED_DEADLINE
+	long expire[2];						// 读、写请求的超时时间（滴答）
+	struct request * fifo[2];			// 读、写请求 FIFO（双向循环链表，表头最早提交）
+	int flush;							// 驱动程序处理 REQ_FLUSH（设备有写缓存）
 };
 
 extern struct blk_dev_struct blk_dev[NR_BLK_DEV];	// 块设备数组，每种设备占用一项（0-无，1-内存设备（虚拟盘等），2-fd 软驱设备，3-hd 硬盘设备，4-ttyx 设备，5-tty 设备，6-Ip 打印机设备）
-extern struct request request[NR_REQUEST];			// 请求队列数组
-extern struct task_struct * wait_for_request;		// 等待请求的任务结构
+extern void release_request(struct blk_dev_struct * dev, struct request * req);
 
 #ifdef MAJOR_NR 									// 主设备号
 
@@ -122,27 +175,56 @@ extern inline void unlock_buffer(struct buffer_head * bh)
 }
 
 /**
- * 结束请求函数
+ * 结束请求函数，请求中尚未结束的所有缓冲块都以同样的结果结束
  * @param uptodate 是否更新（未置位表明处理请求出错）
 */
 extern inline void end_request(int uptodate)
 {
+	struct buffer_head * bh;
+	struct request * req;
+
 	DEVICE_OFF(CURRENT->dev); 		// 关闭块设备
-	// 处理缓冲区
-	if (CURRENT->bh) {
-		CURRENT->bh->b_uptodate = uptodate; // 设置缓冲区更新标志
-		unlock_buffer(CURRENT->bh); // 解锁缓冲区
-	}
 	// 处理错误
 	if (!uptodate) {
 		printk(DEVICE_NAME " I/O error\n\r");
-		printk("dev %04x, block %d\n\r",CURRENT->dev,
-			CURRENT->bh->b_blocknr);
+		if (CURRENT->bh)
+			printk("dev %04x, block %d\n\r",CURRENT->dev,
+				CURRENT->bh->b_blocknr);
+	}
+	// 处理缓冲区链表中的每个缓冲块
+	while (bh = CURRENT->bh) {
+		CURRENT->bh = bh->b_reqnext;
+		bh->b_reqnext = NULL;
+		bh->b_uptodate = uptodate; // 设置缓冲区更新标志
+		unlock_buffer(bh); // 解锁缓冲区
 	}
 	wake_up(&CURRENT->waiting);		// 唤醒等待该请求项的进程
-	wake_up(&wait_for_request);		// 唤醒等待请求的进程
 	CURRENT->dev = -1;				// 设置当前设备为 未使用
-	CURRENT = CURRENT->next;		// 处理下一请求
+	req = CURRENT;
+	CURRENT = req->next;			// 处理下一请求
+	release_request(blk_dev+MAJOR_NR,req);	// 放回请求项，并由调度算法决定下一请求
+}
+
+/**
+ * 当前请求传输完一个扇区后调用，移动扇区号与缓冲区指针；
+ * 合并请求中一个缓冲块的两个扇区都传输完后，结束该缓冲块并让缓冲区指针指向下一缓冲块的数据区
+ * @return 请求中还未传输的扇区数
+*/
+extern inline int next_sector(void)
+{
+	struct buffer_head * bh;
+
+	CURRENT->sector++;
+	if ((CURRENT->sector & 1) || !(bh = CURRENT->bh) || !bh->b_reqnext)
+		CURRENT->buffer += 512;
+	else {
+		CURRENT->bh = bh->b_reqnext;
+		CURRENT->buffer = CURRENT->bh->b_data;
+		bh->b_reqnext = NULL;
+		bh->b_uptodate = 1;
+		unlock_buffer(bh);
+	}
+	return --CURRENT->nr_sectors;
 }
 
 /**
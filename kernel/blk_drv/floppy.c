@@ -132,6 +132,24 @@ static unsigned char command = 0; 					// 发送给软盘控制器的命令
 unsigned char selected = 0;							// 当前选择使用的软驱
 struct task_struct * wait_on_floppy_select = NULL; 	// 等待当前操作完成的进程
 
+/*
+ * Track cache: a read that misses reads the whole cylinder (both heads,
+ * using the multi-track bit of FD_READ) with one command into
+ * track_buffer, and the request and the ones after it are served from
+ * there as long as they stay on that cylinder. Writes that touch the
+ * cached drive invalidate it, as does a detected disk change. A read
+ * that has already failed falls back to the old one-block transfer, so
+ * a single bad sector doesn't make the whole cylinder unreadable.
+ */
+#define TRACK_SECTORS	36 									// 一个柱面最多扇区数（18 扇区 × 2 磁头）
+#define TRACK_BYTES		(TRACK_SECTORS*512)
+static char track_area[2*TRACK_BYTES];						// 从中取出不跨越 64KB 边界的一段作为磁道缓冲
+static char * track_buffer = track_area; 					// 磁道缓冲区（DMA 可直接访问）
+static int cache_dev = -1; 									// 磁道缓冲中数据所属的软盘（次设备号），-1 表示无效
+static unsigned int cache_start = 0; 						// 磁道缓冲中第一个扇区号
+static unsigned int cache_len = 0; 							// 磁道缓冲中的扇区数
+static int track_read = 0; 									// 当前命令是读整个柱面到磁道缓冲
+
 /**
  * 释放当前使用的软驱
  * @param nr 当前选择的软驱号（0-3）
@@ -163,6 +181,8 @@ repeat:
 	if ((current_DOR & 3) != nr) 				// 当前进程被唤醒后，依然不是指定软驱则循环直到时指定软驱
 		goto repeat;
 	if (inb(FD_DIR) & 0x80) { 					// 取数字寄存器值，最高位（位7）置位则表示该软盘已被更换，关闭电动机返回1
+		if (cache_dev >= 0 && DRIVE(cache_dev) == nr)
+			cache_dev = -1; 					// 磁道缓冲中是原来软盘的数据
 		floppy_off(nr);
 		return 1;
 	}
@@ -180,16 +200,46 @@ __asm__("cld ; rep ; movsl" \
 	::"c" (BLOCK_SIZE/4),"S" ((long)(from)),"D" ((long)(to)) \
 	:"cx","di","si")
 
+/**
+ * 复制一个扇区
+ * @param from 原地址
+ * @param to 目标地址
+*/
+#define copy_sector(from,to) \
+__asm__("cld ; rep ; movsl" \
+	::"c" (512/4),"S" ((long)(from)),"D" ((long)(to)) \
+	:"cx","di","si")
+
+/**
+ * 从磁道缓冲中取出当前读请求位于缓存柱面上的扇区
+ * @return 请求中还未读的扇区数
+*/
+static int read_from_cache(void)
+{
+	while (CURRENT->nr_sectors && MINOR(CURRENT->dev) == cache_dev &&
+	    CURRENT->sector - cache_start < cache_len) {
+		copy_sector(track_buffer + ((CURRENT->sector - cache_start) << 9),
+			CURRENT->buffer);
+		next_sector();
+	}
+	return CURRENT->nr_sectors;
+}
+
 /**
  * 设置（初始化）软盘 DMA 通道
 */
 static void setup_DMA(void)
 {
 	long addr = (long) CURRENT->buffer; 	// 获取当前缓冲区地址
+	long count = 1024 - 1; 					// 传输字节数 - 1
 
 	cli(); 									// 禁止中断
+	// 读整个柱面时直接传输到磁道缓冲
+	if (track_read) {
+		addr = (long) track_buffer;
+		count = (floppy->sect * floppy->head << 9) - 1;
 	// 如果缓冲区处于 1MB 以上的地址，则将 DMA 设置在临时软盘缓冲区（因为 8237A 芯片只能在 1MB 的地址范围内寻址）
-	if (addr >= 0x100000) {
+	} else if (addr >= 0x100000) {
 		addr = (long) tmp_floppy_area; 		//指向零食缓冲区
 		// 将要写入软盘的内容复制到临时缓冲区
 		if (command == FD_WRITE)
@@ -212,9 +262,9 @@ static void setup_DMA(void)
 /* bits 16-19 of addr */
 	immoutb_p(addr,0x81); 					// 由于 DMA 寄存器只可以在 1MB，其高 16～19 位地址需放入页面寄存器（端口 81）
 /* low 8 bits of count-1 (1024-1=0x3ff) */
-	immoutb_p(0xff,5); 						// 向 DMA 通道 2 基/当前字节计数器值（端口 0x81）
+	immoutb_p(count,5); 					// 向 DMA 通道 2 基/当前字节计数器值（端口 0x81）
 /* high 8 bits of count-1 */
-	immoutb_p(3,5); 						// 一共传输 2个扇区 (1024B)
+	immoutb_p(count >> 8,5); 				// 一般传输 2个扇区 (1024B)，读柱面时为整个柱面
 /* activate DMA 2 */
 	immoutb_p(0|2,10); 						//开启DMA 通道2 的请求
 	sti(); 									//允许中断
@@ -296,6 +346,7 @@ static void rw_interrupt(void)
 {
 	// 当放回值结果字节数不为 7 或状态字节 0、1、2 中存在错误标志时进程错误处理
 	if (result() != 7 || (ST0 & 0xf8) || (ST1 & 0xbf) || (ST2 & 0x73)) {
+		track_read = 0;
 		if (ST1 & 0x02) { 	// 写保护错误，打印错误，释放当前驱动器，然后退出
 			printk("Drive %d is write protected\n\r",current_drive);
 			floppy_deselect(current_drive);
@@ -305,11 +356,25 @@ static void rw_interrupt(void)
 		do_fd_request();
 		return;
 	}
+	// 整个柱面已读入磁道缓冲，由 do_fd_request 从中取出请求的扇区
+	if (track_read) {
+		track_read = 0;
+		cache_dev = MINOR(CURRENT->dev);
+		cache_start = (CURRENT->sector / (floppy->sect * floppy->head)) *
+			floppy->sect * floppy->head;
+		cache_len = floppy->sect * floppy->head;
+		floppy_deselect(current_drive);
+		do_fd_request();
+		return;
+	}
 	// 读操作且使用临时内存时，将临时内存中读出的数据复制到指定软驱读取的实际缓冲内存中去
 	if (command == FD_READ && (unsigned long)(CURRENT->buffer) >= 0x100000)
 		copy_buffer(tmp_floppy_area,CURRENT->buffer);
 	floppy_deselect(current_drive); // 释放当前软驱，在执行其他软盘请求项
-	end_request(1);
+	// 每次只传输一个缓冲块（2 个扇区）；合并请求中还有缓冲块时继续处理本请求
+	next_sector();
+	if (!next_sector())
+		end_request(1);
 	do_fd_request();
 }
 
@@ -482,6 +547,7 @@ static void reset_floppy(void)
 		__asm__("nop");
 	outb(current_DOR,FD_DOR); 			// 在启动软盘控制器
 	sti(); 								// 开启中断
+	cache_dev = -1;						// 复位后不再相信磁道缓冲中的数据
 }
 
 /**
@@ -509,6 +575,7 @@ void do_fd_request(void)
 	unsigned int block; 								// 操作扇区指针
 
 	seek = 0;
+	track_read = 0;
 	// 复位标志置位时，执行复位操作
 	if (reset) {
 		reset_floppy();
@@ -529,6 +596,22 @@ void do_fd_request(void)
 		end_request(0);
 		goto repeat;
 	}
+	if (CURRENT->cmd == READ) {
+		// 先从磁道缓冲中取，全部命中时请求直接结束
+		if (!read_from_cache()) {
+			end_request(1);
+			goto repeat;
+		}
+		block = CURRENT->sector;
+		// 未出过错时读入整个柱面：从 0 磁头 1 扇区开始，多磁道方式一直读到 1 磁头的最后一个扇区
+		if (!CURRENT->errors) {
+			track_read = 1;
+			block = (block / (floppy->sect * floppy->head)) *
+				floppy->sect * floppy->head;
+		}
+	} else if (cache_dev >= 0 && DRIVE(cache_dev) == CURRENT_DEV &&
+	    (MINOR(CURRENT->dev) != cache_dev || block - cache_start < cache_len))
+		cache_dev = -1; 								// 写到了缓存的柱面，磁道缓冲失效
 	sector = block % floppy->sect; 						// 对扇区数与没磁道扇区数求模，获取请求所在磁道扇区
 	block /= floppy->sect; 								// 获取请求起始磁道号
 	head = block % floppy->head; 						// 获取当前磁头号
@@ -556,4 +639,7 @@ void floppy_init(void)
 	set_trap_gate(0x26,&floppy_interrupt);
 	// 复位软盘控制器的中断屏蔽位，允许软盘控制器发送中断请求信号
 	outb(inb_p(0x21)&~0x40,0x21);
+	// DMA 传输不能跨越 64KB 边界：磁道缓冲跨越时移到边界之后
+	if (((long) track_buffer & 0xffff) + TRACK_BYTES > 0x10000)
+		track_buffer = (char *) (((long) track_buffer + 0xffff) & ~0xffff);
 }
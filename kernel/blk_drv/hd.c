@@ -34,15 +34,102 @@ outb_p(0x80|addr,0x70); \
 inb_p(0x71); \
 })
 
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#define MAX(a,b) (((a)>(b))?(a):(b))
+
 /* Max read/write errors/sector */
 #define MAX_ERRORS	7 			// 单个请求最大错误次数
 #define MAX_HD		2 			// 系统支持的最大硬盘数量
 
 static void recal_intr(void);
+static void write_intr(void);
+static void write_sectors(int n);
+static void reset_poll(void);
+static void bad_rw_intr(void);
 
 static int recalibrate = 1; 	//重新矫正标志，将磁头移动到 0 柱面
 static int reset = 1; 			// 复位标志
 
+/*
+ * The driver doesn't busy-wait for long on the status port. When the
+ * controller is busy, after a reset or while a write waits for DRQ, the
+ * state is rechecked from a one-tick timer; hd_wait keeps do_hd_request
+ * from starting another command meanwhile, and after HD_TIMEOUT ticks
+ * the wait is treated as an error. The one exception is DRQ after a
+ * write command: a drive normally raises it within microseconds, so it
+ * is polled DRQ_SPIN times first, and the timer (a whole tick per
+ * write) is only the fallback for slow drives.
+ */
+#define HD_TIMEOUT	(2*HZ)		// 等待控制器的最长时间（滴答）
+#define DRQ_SPIN	300			// 写命令后直接查询 DRQ 的次数
+
+static int hd_wait = 0; 		// 正在由定时器等待控制器
+static int hd_ticks = 0; 		// 已等待的滴答数
+static int drq_wait = 0; 		// 写命令正在等待数据请求（DRQ）
+
+/*
+ * READ/WRITE MULTIPLE: at setup time IDENTIFY tells how many sectors
+ * the drive can move per interrupt. The multiple mode is (re)set with
+ * SET MULTIPLE before the first request after every reset, and
+ * mult_count stays 0 (plain one sector per interrupt) if the drive
+ * refuses it.
+ */
+#define MAX_MULT	16			// 多扇区模式每组最多扇区数
+
+static int mult_req[MAX_HD] = {0,};		// 期望的每组扇区数（由识别信息得到，0 表示不支持）
+static int mult_count[MAX_HD] = {0,};	// 当前生效的每组扇区数（0 表示未使用多扇区模式）
+static int special_op[MAX_HD] = {0,};	// 复位后需要重新设置多扇区模式
+static int hd_unflushed[MAX_HD] = {0,};	// 上次刷新写缓存后驱动器又执行过写命令
+static int hd_lba[MAX_HD] = {0,};		// 驱动器使用 LBA 寻址
+static int hd_block = 1;				// 当前请求每次中断传输的扇区数
+static int hd_nsent = 0;				// 写请求中已写出、等待中断确认的扇区数
+
+/*
+ * Bus-master DMA: if a PCI IDE controller with bus-master support is
+ * found, a PRD table (one entry per buffer block of the request) is
+ * built in a page of its own, and READ/WRITE DMA moves the whole request
+ * with a single interrupt at the end. Drives that don't report DMA, or
+ * that fail a DMA transfer, are driven with PIO as before.
+ */
+struct prd {
+	unsigned long addr;			// 缓冲区物理地址（内核线性地址与物理地址相同）
+	unsigned short count;		// 字节数
+	unsigned short flags;		// 0x8000-表中最后一项
+};
+
+static int pci_ide = 0;					// 主通道由 PCI IDE 控制器（兼容模式）提供
+static unsigned short bm_base = 0;		// 总线主控寄存器端口基址（0 表示没有 DMA 控制器）
+static struct prd * prd_table = NULL;	// 物理区域描述符表
+static int hd_dma[MAX_HD] = {0,};		// 驱动器使用 DMA 传输
+
+static unsigned short hd_ident[256];	// 驱动器识别信息
+static int hd_ident_state = 0;			// 识别命令状态：0-未进行，1-等待中断，2-成功，3-失败
+static struct task_struct * hd_ident_wait = NULL;	// 等待识别命令完成的进程
+static long hd_ident_deadline = 0;		// 识别命令超时时间（滴答）
+
+/*
+ * 32-bit PIO. Whether "insl" on the data port works is up to the host
+ * controller, not the drive, and the old ISA ones simply drop half the
+ * data. So it is only tried behind a PCI IDE controller, and even then
+ * only after reading IDENTIFY both ways gave the same data. Then the
+ * first BENCH_SECT sectors of the disk are read sequentially in each
+ * width, the time spent on the data port is summed with the 8253, and
+ * 32-bit I/O is used only if it came out faster. Both throughputs are
+ * printed at boot, so the choice can be checked on each machine.
+ */
+#define PIT_LATCH	(1193180/HZ)	// 8253 通道 0 的计数初值（与 sched.c 中的 LATCH 相同）
+#define PIT_US(n)	((n)*419/1000)	// 方式 3 每个时钟减 2，一个计数约 0.419 微秒
+#define BENCH_SECT	64				// 测试传输宽度时顺序读的扇区数（32KB）
+
+static int hd_io32[MAX_HD] = {0,};		// 驱动器数据端口使用 32 位传输
+static int hd_io32cur = 0;				// 当前请求使用 32 位传输
+static int hd_ident_io32 = 0;			// 识别信息、测试读按双字读取（测试 32 位传输时）
+static int bench_left = 0;				// 测试读还未读的扇区数
+static long bench_time = 0;				// 测试读在数据端口上所用的 8253 计数之和
+
+static int identify(int drive);
+static int io32_probe(int drive);
+
 /*
  *  This struct defines the HD's and their types.
  */
@@ -90,6 +177,30 @@ __asm__("cld;rep;insw"::"d" (port),"D" (buf),"c" (nr):"cx","di")
 #define port_write(port,buf,nr) \
 __asm__("cld;rep;outsw"::"d" (port),"S" (buf),"c" (nr):"cx","si")
 
+/**
+ * 以双字读端口
+ * @param nr 读取的双字数
+*/
+#define port_read32(port,buf,nr) \
+__asm__("cld;rep;insl"::"d" (port),"D" (buf),"c" (nr):"cx","di")
+
+/**
+ * 以双字写端口
+ * @param nr 写的双字数
+*/
+#define port_write32(port,buf,nr) \
+__asm__("cld;rep;outsl"::"d" (port),"S" (buf),"c" (nr):"cx","si")
+
+/**
+ * 按当前驱动器支持的宽度读、写一个扇区（128 个双字或 256 个字）
+*/
+#define sector_in(buf) do { \
+if (hd_io32cur) port_read32(HD_DATA,buf,128); else port_read(HD_DATA,buf,256); \
+} while (0)
+#define sector_out(buf) do { \
+if (hd_io32cur) port_write32(HD_DATA,buf,128); else port_write(HD_DATA,buf,256); \
+} while (0)
+
 extern void hd_interrupt(void);
 extern void rd_load(void);
 
@@ -172,6 +283,33 @@ int sys_setup(void * BIOS)
 		hd[i*5].start_sect = 0;
 		hd[i*5].nr_sects = 0;
 	}
+	// 读取各硬盘的识别信息，得到多扇区模式每组扇区数与 LBA 寻址能力
+	for (drive=0 ; drive<NR_HD ; drive++) {
+		if (!identify(drive))
+			continue;
+		if ((hd_ident[ID_MULT] & 0xff) > 1) {
+			mult_req[drive] = MIN(hd_ident[ID_MULT] & 0xff, MAX_MULT);
+			printk("hd%d: %d sectors per interrupt\n\r",drive,mult_req[drive]);
+		}
+		if (bm_base && (hd_ident[ID_CAPAB] & 0x100)) {
+			hd_dma[drive] = 1;
+			printk("hd%d: bus-master DMA\n\r",drive);
+		}
+		// 支持 LBA 时，用识别信息中的扇区总数取代 BIOS 几何参数算出的容量
+		if (hd_ident[ID_CAPAB] & 0x200) {
+			unsigned long n = hd_ident[ID_LBA_LO] |
+				((unsigned long) hd_ident[ID_LBA_HI] << 16);
+			if (n && n <= LBA_MAX) {
+				hd_lba[drive] = 1;
+				hd[drive*5].nr_sects = n;
+				printk("hd%d: LBA, %d sectors\n\r",drive,n);
+			}
+		}
+		if (pci_ide && io32_probe(drive)) {
+			hd_io32[drive] = 1;
+			printk("hd%d: 32-bit I/O\n\r",drive);
+		}
+	}
 	for (drive=0 ; drive<NR_HD ; drive++) {
 		// 读取指定硬盘起始扇区处的 硬盘分区表参数
 		if (!(bh = bread(0x300 + drive*5,0))) {
@@ -202,14 +340,12 @@ int sys_setup(void * BIOS)
 }
 
 /**
- * 循环等待驱动器就绪
+ * 检测控制器是否就绪（就绪且不忙），不等待
+ * @return 就绪 - 1，否则 - 0
 */
 static int controller_ready(void)
 {
-	int retries=10000;
-
-	while (--retries && (inb_p(HD_STATUS)&0xc0)!=0x40);
-	return (retries);
+	return (inb_p(HD_STATUS)&0xc0) == 0x40;
 }
 
 /**
@@ -243,12 +379,9 @@ static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sect,
 {
 	register int port asm("dx"); // port 变量对应寄存器 dx
 
-	// 驱动器号 > 1 或 磁头号 > 15 时 死机不支持
-	if (drive>1 || head>15)
+	// 驱动器号 > 1 或 磁头号 > 15 时 死机不支持（head 中可带 LBA 寻址位）
+	if (drive>1 || (head & ~HD_LBA)>15)
 		panic("Trying to write bad sector");
-	// 驱动器超时未就绪时死机
-	if (!controller_ready())
-		panic("HD controller not ready");
 	do_hd = intr_addr; 					// do_hd 指向硬盘中断处理程序
 	outb_p(hd_info[drive].ctl,HD_CMD); 	// 向控制寄存器中输入控制字节
 	port=HD_DATA; 						// 置 dx 为寄存器端口
@@ -262,51 +395,257 @@ static void hd_out(unsigned int drive,unsigned int nsect,unsigned int sect,
 }
 
 /**
- * 等待硬盘就绪，及循环等待主状态控制器忙标志位复位；
- * 若仅有就绪或寻道结束标志置位，则成功并返回 0；
- * 若经过一段时间后仍为忙 则返回 1 
- * @return 控制器就绪 - 0，控制器忙 - 1
+ * 锁存并读取 8253 通道 0 的当前计数值
 */
-static int drive_busy(void)
+static int pit_read(void)
 {
-	unsigned int i;
+	int n;
 
-	for (i = 0; i < 10000; i++)
-		if (READY_STAT == (inb_p(HD_STATUS) & (BUSY_STAT|READY_STAT))) // 循环 10000次 一旦就绪标志位置位则退出循环
-			break;
-	i = inb(HD_STATUS); // 再取硬盘状态
-	i &= BUSY_STAT | READY_STAT | SEEK_STAT; // 检测忙位、就绪位和寻道结束位
-	if (i == READY_STAT | SEEK_STAT) // 仅满足就绪与寻道状态时，返回 0
-		return(0);
-	printk("HD controller times out\n\r"); // 忙时输出日志，同时返回 1
-	return(1);
+	outb_p(0x00,0x43);
+	n = inb_p(0x40);
+	return n | (inb_p(0x40) << 8);
 }
 
 /**
- * 复位磁盘控制器
+ * 识别命令的硬盘中断处理函数：读出识别信息，唤醒等待进程
+*/
+static void identify_intr(void)
+{
+	if (hd_ident_state != 1)
+		return;
+	if (win_result())
+		hd_ident_state = 3;
+	else {
+		if (hd_ident_io32)
+			port_read32(HD_DATA,hd_ident,128);
+		else
+			port_read(HD_DATA,hd_ident,256);
+		hd_ident_state = 2;
+	}
+	wake_up(&hd_ident_wait);
+}
+
+/**
+ * 测试读的硬盘中断处理函数：读出一个扇区并累计数据端口传输所用时间，全部读完后唤醒等待进程
+*/
+static void bench_intr(void)
+{
+	static unsigned short buf[256];
+	int t;
+
+	if (hd_ident_state != 1)
+		return;
+	if (win_result()) {
+		hd_ident_state = 3;
+		wake_up(&hd_ident_wait);
+		return;
+	}
+	t = pit_read();
+	if (hd_ident_io32)
+		port_read32(HD_DATA,buf,128);
+	else
+		port_read(HD_DATA,buf,256);
+	t -= pit_read();
+	bench_time += (t < 0) ? t + PIT_LATCH : t;	// 计数在两次读之间重装过
+	if (--bench_left > 0) {
+		do_hd = &bench_intr;
+		return;
+	}
+	hd_ident_state = 2;
+	wake_up(&hd_ident_wait);
+}
+
+/**
+ * 识别、测试读命令超时函数（在时钟中断中调用）：驱动器不响应时放弃
+*/
+static void identify_timeout(void)
+{
+	if (hd_ident_state != 1 || jiffies < hd_ident_deadline)	// 已完成，或是前一次识别命令留下的定时器
+		return;
+	do_hd = NULL;
+	hd_ident_state = 3;
+	wake_up(&hd_ident_wait);
+}
+
+/**
+ * 向硬盘发送命令并等待其中断处理函数报告完成；只在 sys_setup 中、硬盘请求队列开始工作前调用
+ * @param drive 硬盘号
+ * @param nsect 扇区数
+ * @param sect 起始扇区（0 柱面 0 磁头）
+ * @param cmd 命令
+ * @param intr 中断处理函数，完成时设置 hd_ident_state
+ * @return 成功返回 1，驱动器出错或不响应时返回 0
+*/
+static int setup_cmd(int drive,int nsect,int sect,int cmd,void (*intr)(void))
+{
+	if (!controller_ready())
+		return 0;
+	cli();
+	hd_ident_state = 1;
+	hd_ident_deadline = jiffies + HZ;
+	hd_out(drive,nsect,sect,0,0,cmd,intr);
+	add_timer(HZ,&identify_timeout);	// add_timer 返回时已开启中断，重新关闭以免错过唤醒
+	cli();
+	while (hd_ident_state == 1)
+		sleep_on(&hd_ident_wait);
+	sti();
+	return hd_ident_state == 2;
+}
+
+/**
+ * 向硬盘发送识别命令并等待其完成，识别信息保存在 hd_ident 中
+ * @param drive 硬盘号
+ * @return 成功返回 1，驱动器不支持或不响应时返回 0
+*/
+static int identify(int drive)
+{
+	return setup_cmd(drive,0,0,WIN_IDENTIFY,&identify_intr);
+}
+
+/**
+ * 按指定宽度从磁盘开头顺序读 BENCH_SECT 个扇区，返回数据端口传输所用时间
+ * @param drive 硬盘号
+ * @param io32 为 1 时按双字读
+ * @return 所用的 8253 计数之和，读失败时返回 0
+*/
+static long io32_bench(int drive,int io32)
+{
+	int ok;
+
+	bench_left = BENCH_SECT;
+	bench_time = 0;
+	hd_ident_io32 = io32;
+	ok = setup_cmd(drive,BENCH_SECT,1,WIN_READ,&bench_intr);
+	hd_ident_io32 = 0;
+	return ok ? bench_time : 0;
+}
+
+/**
+ * 测试数据端口的 32 位传输：先按双字再读一次识别信息，与按字读出的比较；
+ * 数据相同时再按两种宽度各顺序读一遍磁盘开头，比较吞吐率。
+ * 数据不同时驱动器可能还有未读完的数据，让第一个请求先复位控制器。hd_ident 保持按字读出的内容
+ * @param drive 硬盘号
+ * @return 32 位传输可用且更快时返回 1
+*/
+static int io32_probe(int drive)
+{
+	static unsigned short id[256];
+	int i, ok;
+	long t16, t32;
+
+	for (i=0 ; i<256 ; i++)
+		id[i] = hd_ident[i];
+	hd_ident_io32 = 1;
+	ok = identify(drive);
+	hd_ident_io32 = 0;
+	for (i=0 ; i<256 ; i++) {
+		if (hd_ident[i] != id[i])
+			ok = 0;
+		hd_ident[i] = id[i];
+	}
+	if (!ok) {
+		reset = 1;
+		printk("hd%d: 32-bit I/O gives bad data\n\r",drive);
+		return 0;
+	}
+	if (!(t16 = io32_bench(drive,0)) || !(t32 = io32_bench(drive,1))) {
+		reset = 1;
+		printk("hd%d: PIO benchmark read failed\n\r",drive);
+		return 0;
+	}
+	// 吞吐率（KB/s）= BENCH_SECT/2 KB 除以所用时间
+	printk("hd%d: PIO read of %d KB: %d KB/s (16-bit), %d KB/s (32-bit)\n\r",drive,
+		BENCH_SECT/2,BENCH_SECT*500000/MAX(PIT_US(t16),1),BENCH_SECT*500000/MAX(PIT_US(t32),1));
+	return t32 < t16;
+}
+
+/**
+ * 复位磁盘控制器：发出复位脉冲后由定时器等待控制器就绪
 */
 static void reset_controller(void)
 {
 	int	i;
 
+	if (bm_base)					// 停止可能还在进行的 DMA 传输
+		outb(0,bm_base+BM_COMMAND);
 	outb(4,HD_CMD); 				// 向控制寄存器端口发送 4-复位 控制字节
 	for(i = 0; i < 100; i++) nop(); // 等待一段时间（复位完成）后
 	outb(hd_info[0].ctl & 0x0f ,HD_CMD); // 在发送正常的控制字节（不禁止重试、重读）
-	if (drive_busy()) 				// 等待硬盘就绪超时，展示错误信息
+	hd_ticks = 0;
+	hd_wait = 1;
+	add_timer(1,&reset_poll);
+}
+
+/**
+ * 复位后等待控制器就绪的定时函数（在时钟中断中调用）；
+ * 就绪或超时后检查复位结果，并发送 "建立驱动器参数" 命令
+*/
+static void reset_poll(void)
+{
+	int i;
+
+	hd_wait = 0;
+	if (!controller_ready() && ++hd_ticks < HD_TIMEOUT) {
+		hd_wait = 1;
+		add_timer(1,&reset_poll);
+		return;
+	}
+	if (hd_ticks >= HD_TIMEOUT) 	// 等待硬盘就绪超时，展示错误信息
 		printk("HD-controller still busy\n\r");
+	hd_ticks = 0;
 	if ((i = inb(HD_ERROR)) != 1) 	// 读取硬盘错误寄存器，若有错误则提示
 		printk("HD-controller reset failed: %02x\n\r",i);
+	if (!CURRENT)
+		return;
+	i = CURRENT_DEV;
+	hd_out(i,hd_info[i].sect,hd_info[i].sect,hd_info[i].head-1,
+		hd_info[i].cyl,WIN_SPECIFY,&recal_intr); 	// 发送硬盘控制命令 "建立驱动器参数"
 }
 
 /**
- * 磁盘复位函数
- * @param nr 当前硬盘号
+ * 控制器忙时等待的定时函数：下一个滴答重新处理请求
 */
-static void reset_hd(int nr)
+static void ready_poll(void)
 {
-	reset_controller(); 							// 复位控制器
-	hd_out(nr,hd_info[nr].sect,hd_info[nr].sect,hd_info[nr].head-1,
-		hd_info[nr].cyl,WIN_SPECIFY,&recal_intr); 	// 发送硬盘控制命令 "建立驱动器参数"
+	hd_wait = 0;
+	do_hd_request();
+}
+
+/**
+ * 写命令等待数据请求的定时函数：DRQ 置位后写出第一组扇区，超时则按出错处理
+*/
+static void drq_poll(void)
+{
+	hd_wait = 0;
+	if (!drq_wait) { 				// 等待中驱动器已用中断报告出错
+		do_hd_request();
+		return;
+	}
+	if (inb_p(HD_STATUS) & DRQ_STAT) {
+		drq_wait = 0;
+		do_hd = &write_intr;
+		write_sectors(MIN(hd_block,CURRENT->nr_sectors));
+		return;
+	}
+	if (++hd_ticks < HD_TIMEOUT) {
+		hd_wait = 1;
+		add_timer(1,&drq_poll);
+		return;
+	}
+	drq_wait = 0;
+	do_hd = NULL;
+	bad_rw_intr();
+	do_hd_request();
+}
+
+/**
+ * 写命令等待 DRQ 期间来的中断：命令出错，由 drq_poll 继续处理请求
+*/
+static void drq_intr(void)
+{
+	drq_wait = 0;
+	win_result();
+	bad_rw_intr();
 }
 
 /**
@@ -332,22 +671,27 @@ static void bad_rw_intr(void)
 
 /**
  * 读中断调用函数，执行硬盘中断请求中调用
+ * 每次中断读入一组扇区（多扇区模式下为 mult_count 个，否则为 1 个）
 */
 static void read_intr(void)
 {
+	int n;
+
 	// 判断当前硬盘控制器状态是否能使用
 	if (win_result()) {
 		bad_rw_intr();
 		do_hd_request();
 		return;
 	}
-	// 一次读取一个扇区 (256 字节) 到缓冲区
-	port_read(HD_DATA,CURRENT->buffer,256);
 	CURRENT->errors = 0; 	// 重置错误次数
-	CURRENT->buffer += 512; // 移动缓冲区指针
-	CURRENT->sector++; 		// 扇区 + 1
+	// 一次读取一个扇区 (256 字) 到缓冲区，并移动扇区号与缓冲区指针
+	for (n = hd_block ; n > 0 ; n--) {
+		sector_in(CURRENT->buffer);
+		if (!next_sector())
+			break;
+	}
 	// 数据未读完时 
-	if (--CURRENT->nr_sectors) {
+	if (CURRENT->nr_sectors) {
 		do_hd = &read_intr; // 再次置硬盘调用 c 函数指针为 read_intr()
 		return;
 	}
@@ -356,8 +700,31 @@ static void read_intr(void)
 	do_hd_request();
 }
 
+/**
+ * 从当前请求的当前位置开始写出一组扇区：只移动局部的缓冲区指针，请求的位置等中断确认写完后再移动
+ * @param n 扇区数
+*/
+static void write_sectors(int n)
+{
+	struct buffer_head * bh = CURRENT->bh;
+	char * buf = CURRENT->buffer;
+	unsigned long sector = CURRENT->sector;
+
+	hd_nsent = n;
+	while (n-- > 0) {
+		sector_out(buf);
+		if ((++sector & 1) || !bh || !bh->b_reqnext)
+			buf += 512;
+		else {
+			bh = bh->b_reqnext;
+			buf = bh->b_data;
+		}
+	}
+}
+
 /**
  * 写中断调用函数，执行写中断请求中调用
+ * 每次中断确认上一组扇区已写完，再写出下一组
 */
 static void write_intr(void)
 {
@@ -367,19 +734,179 @@ static void write_intr(void)
 		do_hd_request();
 		return;
 	}
+	// 上一组扇区已写完，移动扇区号与缓冲区指针
+	while (hd_nsent-- > 0)
+		next_sector();
 	// 当前需要写的扇区还未写完时
-	if (--CURRENT->nr_sectors) {
-		CURRENT->sector++; // 扇区号 + 1
-		CURRENT->buffer += 512; // 缓冲区 +1
-		do_hd = &write_intr; // 再次调用 读 函数
-		port_write(HD_DATA,CURRENT->buffer,256); // 读取一个扇区
+	if (CURRENT->nr_sectors) {
+		do_hd = &write_intr; // 再次调用 写 函数
+		write_sectors(MIN(hd_block,CURRENT->nr_sectors));
 		return;
 	}
-	// 读完后，正常退出，通知阻塞的进程，处理下一请求
+	// 写完后，正常退出，通知阻塞的进程，处理下一请求
+	end_request(1);
+	do_hd_request();
+}
+
+/**
+ * 读 PCI 配置空间（配置机制 1）
+ * @param bus 总线号
+ * @param dev 设备号
+ * @param fn 功能号
+ * @param reg 寄存器偏移（双字对齐）
+*/
+static unsigned long pci_read(int bus,int dev,int fn,int reg)
+{
+	outl(0x80000000 | (bus<<16) | (dev<<11) | (fn<<8) | (reg & 0xfc),0xCF8);
+	return inl(0xCFC);
+}
+
+/**
+ * 写 PCI 配置空间
+*/
+static void pci_write(int bus,int dev,int fn,int reg,unsigned long val)
+{
+	outl(0x80000000 | (bus<<16) | (dev<<11) | (fn<<8) | (reg & 0xfc),0xCF8);
+	outl(val,0xCFC);
+}
+
+/**
+ * 检查 0 号总线上的一个 PCI 功能：是 IDE 控制器（类代码 0x0101）时记录主通道是否为兼容模式；
+ * 支持总线主控（编程接口位 7）时打开其 I/O 与总线主控使能位，并分配 PRD 表
+ * @param dev 设备号
+ * @param fn 功能号
+ * @return 找到总线主控控制器（或无法分配 PRD 表）、不必再查找时返回 1
+*/
+static int dma_probe(int dev,int fn)
+{
+	unsigned long class,bar;
+
+	class = pci_read(0,dev,fn,0x08);
+	if ((class >> 16) != 0x0101)
+		return 0;
+	if (!(class & 0x100))				// 主通道工作在兼容模式（端口 0x1f0）
+		pci_ide = 1;
+	if (!(class & 0x8000))
+		return 0;
+	bar = pci_read(0,dev,fn,0x20);		// BAR4：总线主控寄存器（I/O 空间）
+	if (!(bar & 1) || !(bar & 0xfff0))
+		return 0;
+	if (!(prd_table = (struct prd *) get_free_page()))
+		return 1;
+	pci_write(0,dev,fn,0x04,pci_read(0,dev,fn,0x04) | 0x05);
+	bm_base = bar & 0xfffc;
+	printk("IDE bus-master DMA at 0x%04x\n\r",bm_base);
+	return 1;
+}
+
+/**
+ * 在 0 号总线上查找支持总线主控的 IDE 控制器；单功能设备只检查功能 0
+*/
+static void dma_init(void)
+{
+	int dev,fn;
+
+	for (dev=0 ; dev<32 ; dev++)
+		for (fn=0 ; fn<8 ; fn++) {
+			if ((pci_read(0,dev,fn,0) & 0xffff) == 0xffff) {
+				if (!fn)					// 功能 0 不存在，该设备不存在
+					break;
+				continue;
+			}
+			if (dma_probe(dev,fn))
+				return;
+			// 头部类型第 7 位为 0 时是单功能设备，功能 1-7 可能只是功能 0 的重影
+			if (!fn && !(pci_read(0,dev,0,0x0c) & 0x800000))
+				break;
+		}
+}
+
+/**
+ * 按当前请求的缓冲块链设置 PRD 表，并设置总线主控的传输方向
+*/
+static void dma_setup(void)
+{
+	struct buffer_head * bh = CURRENT->bh;
+	struct prd * p = prd_table;
+	int left = CURRENT->nr_sectors * 512;
+	int n;
+
+	// 第一项从当前位置开始（重试时可能停在缓冲块中间）
+	p->addr = (unsigned long) CURRENT->buffer;
+	n = (bh && bh->b_reqnext) ? ((CURRENT->sector & 1) ? 512 : 1024) : left;
+	while (1) {
+		p->count = n = MIN(n,left);
+		p->flags = 0;
+		if (!(left -= n) || !bh || !(bh = bh->b_reqnext))
+			break;
+		p++;
+		p->addr = (unsigned long) bh->b_data;
+		n = bh->b_reqnext ? 1024 : left;
+	}
+	p->flags = 0x8000;
+	outb(0,bm_base+BM_COMMAND);
+	outb(inb(bm_base+BM_STATUS) | BM_ERR | BM_INTR,bm_base+BM_STATUS);	// 清除出错与中断位
+	outl((unsigned long) prd_table,bm_base+BM_PRDT);
+	outb((CURRENT->cmd == READ) ? BM_READ : 0,bm_base+BM_COMMAND);
+}
+
+/**
+ * DMA 传输结束中断调用函数：整个请求一次传输完成
+*/
+static void dma_intr(void)
+{
+	unsigned char st;
+
+	outb(inb(bm_base+BM_COMMAND) & ~BM_START,bm_base+BM_COMMAND);	// 停止总线主控
+	st = inb(bm_base+BM_STATUS);
+	outb(st | BM_ERR | BM_INTR,bm_base+BM_STATUS);
+	// 总线主控出错时，该驱动器退回 PIO 方式重试；驱动器可能还在执行 DMA 命令，先复位控制器
+	if (st & BM_ERR) {
+		printk("hd%d: DMA error, using PIO\n\r",CURRENT_DEV);
+		hd_dma[CURRENT_DEV] = 0;
+		reset = 1;
+		do_hd_request();
+		return;
+	}
+	if (win_result()) {
+		bad_rw_intr();
+		do_hd_request();
+		return;
+	}
+	end_request(1);
+	do_hd_request();
+}
+
+/**
+ * 刷新写缓存中断调用函数；不支持该命令的老驱动器没有写缓存，放弃命令也算成功
+*/
+static void flush_intr(void)
+{
+	if (win_result() && !(inb(HD_ERROR) & ABRT_ERR)) {
+		bad_rw_intr();
+		do_hd_request();
+		return;
+	}
+	hd_unflushed[CURRENT_DEV] = 0;
 	end_request(1);
 	do_hd_request();
 }
 
+/**
+ * 设置多扇区模式中断调用函数：驱动器拒绝时退回每次中断传输一个扇区
+*/
+static void setmult_intr(void)
+{
+	int drive = CURRENT_DEV;
+
+	if (win_result()) {
+		printk("hd%d: SET MULTIPLE failed, using single sector mode\n\r",drive);
+		mult_count[drive] = 0;
+	} else
+		mult_count[drive] = mult_req[drive];
+	do_hd_request();
+}
+
 /**
  * 硬盘重新矫正（复位）中断调用函数；在硬盘中断处理函数中调用
  * 如果硬盘控制器返回错误信息，首先进行硬盘读写失败处理，然后请求硬盘做相应（复位）处理
@@ -396,36 +923,62 @@ static void recal_intr(void)
 */
 void do_hd_request(void)
 {
-	int i,r;
+	int i;
 	unsigned int block,dev;
 	unsigned int sec,head,cyl;
 	unsigned int nsect;
 
+	if (hd_wait) 				// 正在由定时器等待控制器，届时再处理
+		return;
 	INIT_REQUEST; 				// 检测请求项的合法性
 	dev = MINOR(CURRENT->dev); 	// dev 指向当前分区号
 	block = CURRENT->sector; 	// bolck 指向当前需操作的起始扇区
 	
-	// 当分区不存在以及起始扇区大于该分区扇区数-2（因为每次读写要求两个扇区，因此读取起始扇区不能大于该分区扇区数-2）时，直接退出
-	if (dev >= 5*NR_HD || block+2 > hd[dev].nr_sects) {
+	// 当分区不存在以及请求的扇区超出该分区范围时，直接退出
+	if (dev >= 5*NR_HD || block+CURRENT->nr_sectors > hd[dev].nr_sects) {
 		end_request(0);
 		goto repeat;
 	}
 	block += hd[dev].start_sect; // 指向实际硬盘起始扇区
 	dev /= 5; 					// dev 指向实际硬盘号 0 或者 1
-	// 下面两行嵌入式汇编代码，根据硬盘起始扇区号和每磁道扇区数计算在磁道中的扇区号（sec）、所在柱面号（cyl）和磁头号（head）
-	__asm__("divl %4":"=a" (block),"=d" (sec):"0" (block),"1" (0),
-		"r" (hd_info[dev].sect));
-	__asm__("divl %4":"=a" (cyl),"=d" (head):"0" (block),"1" (0),
-		"r" (hd_info[dev].head));
-	sec++;
+	if (hd_lba[dev]) {
+		// LBA 寻址：28 位线性扇区号依次放入扇区号、柱面号低/高字节与磁头号寄存器
+		sec = block & 0xff;
+		cyl = (block >> 8) & 0xffff;
+		head = ((block >> 24) & 0x0f) | HD_LBA;
+	} else {
+		// 下面两行嵌入式汇编代码，根据硬盘起始扇区号和每磁道扇区数计算在磁道中的扇区号（sec）、所在柱面号（cyl）和磁头号（head）
+		__asm__("divl %4":"=a" (block),"=d" (sec):"0" (block),"1" (0),
+			"r" (hd_info[dev].sect));
+		__asm__("divl %4":"=a" (cyl),"=d" (head):"0" (block),"1" (0),
+			"r" (hd_info[dev].head));
+		sec++;
+	}
 	nsect = CURRENT->nr_sectors; //预读取扇区数
 	// 如果复位标志为 1 这执行复位操作
 	if (reset) {
 		reset = 0;
 		recalibrate = 1; 		// 复位后需要进行重新矫正
-		reset_hd(CURRENT_DEV);
+		for (i=0 ; i<NR_HD ; i++) {	// 复位后需要重新设置多扇区模式
+			mult_count[i] = 0;
+			special_op[i] = mult_req[i] > 1;
+		}
+		reset_controller(); 	// 复位控制器，就绪后由 reset_poll 发送 "建立驱动器参数" 命令
 		return;
 	}
+	// 控制器忙时不空等，下一个滴答再试；等待超时按出错处理
+	if (!controller_ready()) {
+		if (++hd_ticks < HD_TIMEOUT) {
+			hd_wait = 1;
+			add_timer(1,&ready_poll);
+			return;
+		}
+		printk("HD controller not ready\n\r");
+		hd_ticks = 0;
+		bad_rw_intr();
+		goto repeat;
+	}
+	hd_ticks = 0;
 	// 当重新矫正标志置位时，首先需要重新矫正标志
 	if (recalibrate) {
 		recalibrate = 0;
@@ -433,24 +986,57 @@ void do_hd_request(void)
 			WIN_RESTORE,&recal_intr);	// 发送重新矫正命令
 		return;
 	}	
+	// 复位后首先设置多扇区模式每组扇区数
+	if (special_op[dev]) {
+		special_op[dev] = 0;
+		hd_out(dev,mult_req[dev],0,0,0,WIN_SETMULT,&setmult_intr);
+		return;
+	}
+	// 刷新请求：让驱动器把写缓存写到盘片上
+	if (!nsect) {
+		if (!(CURRENT->flags & REQ_FLUSH))
+			panic("hd: empty request");
+		if (!hd_unflushed[dev]) {
+			end_request(1);
+			goto repeat;
+		}
+		hd_out(dev,0,0,0,0,WIN_FLUSH,&flush_intr);
+		return;
+	}
+	if (CURRENT->cmd == WRITE)
+		hd_unflushed[dev] = 1;
+	// 能用 DMA 时，整个请求由一条命令传输，只在结束时中断一次
+	if (hd_dma[dev] && (CURRENT->cmd == READ || CURRENT->cmd == WRITE)) {
+		dma_setup();
+		hd_out(dev,nsect,sec,head,cyl,
+			(CURRENT->cmd == READ) ? WIN_READDMA : WIN_WRITEDMA,&dma_intr);
+		outb(inb(bm_base+BM_COMMAND) | BM_START,bm_base+BM_COMMAND);
+		return;
+	}
+	// 多扇区模式下每次中断传输一组扇区
+	hd_block = (mult_count[dev] > 1 && nsect > 1) ? mult_count[dev] : 1;
+	hd_io32cur = hd_io32[dev];
 	// 处理写请求
 	if (CURRENT->cmd == WRITE) {
-		// 发写读命令
-		hd_out(dev,nsect,sec,head,cyl,WIN_WRITE,&write_intr);
-		// 等待 硬盘控制器请求服务位置位
-		for(i=0 ; i<3000 && !(r=inb_p(HD_STATUS)&DRQ_STAT) ; i++)
+		// 发写命令
+		hd_out(dev,nsect,sec,head,cyl,
+			(hd_block > 1) ? WIN_MULTWRITE : WIN_WRITE,&write_intr);
+		// 先短暂查询数据请求位，置位后直接写第一组扇区；否则（或出错时）由定时器等待
+		for (i=0 ; i<DRQ_SPIN && !(inb_p(HD_STATUS) & (DRQ_STAT|ERR_STAT)) ; i++)
 			/* nothing */ ;
-		// 循环结束后依然未就绪，则此次写失败，处理下一个硬盘请求
-		if (!r) {
-			bad_rw_intr();
-			goto repeat;
+		if ((inb_p(HD_STATUS) & (DRQ_STAT|ERR_STAT)) == DRQ_STAT)
+			write_sectors(MIN(hd_block,nsect));
+		else {
+			do_hd = &drq_intr;
+			drq_wait = 1;
+			hd_wait = 1;
+			add_timer(1,&drq_poll);
 		}
-		// 写 一个扇区
-		port_write(HD_DATA,CURRENT->buffer,256);
 		// 处理读请求
 	} else if (CURRENT->cmd == READ) {
 		// 发送读命令
-		hd_out(dev,nsect,sec,head,cyl,WIN_READ,&read_intr);
+		hd_out(dev,nsect,sec,head,cyl,
+			(hd_block > 1) ? WIN_MULTREAD : WIN_READ,&read_intr);
 	} else
 		panic("unknown hd-command");
 }
@@ -461,8 +1047,10 @@ void do_hd_request(void)
 void hd_init(void)
 {
 	blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;
+	blk_dev[MAJOR_NR].flush = 1; 	// 硬盘可能有写缓存，需要处理刷新请求
 	// 设置 硬盘中断向量为 46
 	set_intr_gate(0x2E,&hd_interrupt);
 	outb_p(inb_p(0x21)&0xfb,0x21); // 复位主 8259A int2 屏蔽位，允许从片发送中断信号
 	outb(inb_p(0xA1)&0xbf,0xA1); // 复位 硬盘中断屏蔽位，允许硬盘控制器发送中断请求信号
+	dma_init(); 				// 查找总线主控 IDE 控制器
 }
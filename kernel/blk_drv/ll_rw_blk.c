@@ -11,12 +11,20 @@
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <asm/system.h>
+#include <asm/segment.h>
 
 #include "blk.h"
 
-struct request request[NR_REQUEST]; 			// 请求数组（含有加载 nr 扇区数据到内存中的所有必须的信息）
+static int nr_requests[NR_BLK_DEV] = {
+	0, NR_REQUEST_RD, NR_REQUEST_FD, NR_REQUEST_HD, 0, 0, 0
+};												// 各设备请求项数，在 blk_dev_init 中按此分配
 
-struct task_struct * wait_for_request = NULL; 	// 请求数组已满时，最新的等待进程指针
+static int unplug_timer_on = 0;					// 开塞定时器是否已设置
+
+static int default_sched[NR_BLK_DEV] = {
+	SCHED_ELEVATOR, SCHED_ELEVATOR, SCHED_DEADLINE, SCHED_DEADLINE,
+	SCHED_ELEVATOR, SCHED_ELEVATOR, SCHED_ELEVATOR
+};												// 各设备默认的调度算法
 
 /* blk_dev_struct is:
  *	do_request-address
@@ -35,12 +43,41 @@ struct blk_dev_struct blk_dev[NR_BLK_DEV] = {
 	{ NULL, NULL }		// 6- lp 打印机设备
 };
 
+/**
+ * 拔出所有块设备队列的塞子：对被塞住的队列调用其请求处理函数，开始处理队列中的请求
+*/
+void unplug_devices(void)
+{
+	struct blk_dev_struct * dev;
+	int plugged;
+
+	for (dev = blk_dev ; dev < blk_dev + NR_BLK_DEV ; dev++) {
+		cli();
+		plugged = dev->plugged;
+		dev->plugged = 0;
+		sti();
+		if (plugged && dev->current_request)
+			(dev->request_fn)();
+	}
+}
+
+/**
+ * 开塞定时器到时函数（在时钟中断中调用）
+*/
+static void unplug_timeout(void)
+{
+	unplug_timer_on = 0;
+	unplug_devices();
+}
+
 /**
  * 对指定缓冲上锁
  * @param bh 指定需要上锁缓冲头指针
 */
 static inline void lock_buffer(struct buffer_head * bh)
 {
+	if (bh->b_lock) // 要等待时先开始处理被塞住的请求队列
+		unplug_devices();
 	cli();
 	while (bh->b_lock) // 等待其他进程释放锁
 		sleep_on(&bh->b_wait);
@@ -61,37 +98,193 @@ static inline void unlock_buffer(struct buffer_head * bh)
 	wake_up(&bh->b_wait); // 唤醒等待该缓冲区解锁的任务
 }
 
+/**
+ * 将请求项加入本设备同方向请求 FIFO 的表尾，并按其 I/O 优先级级别设置到期时间；空闲类别的请求没有到期时间，不加入 FIFO
+ * @param dev 指定块设备指针
+ * @param req 请求项
+*/
+static inline void fifo_add(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request ** fifo = dev->fifo + req->cmd;
+
+	req->fifo_prev = req->fifo_next = NULL;
+	if (IO_CLASS(req) == IOPRIO_CLASS_IDLE || (req->flags & REQ_FLUSH))
+		return;
+	req->expires = jiffies + dev->expire[req->cmd] *
+		(IOPRIO_LEVEL(req->ioprio)+1) / (IOPRIO_NORM+1);
+	if (!*fifo) {
+		*fifo = req->fifo_prev = req->fifo_next = req;
+		return;
+	}
+	req->fifo_next = *fifo;
+	req->fifo_prev = (*fifo)->fifo_prev;
+	(*fifo)->fifo_prev->fifo_next = req;
+	(*fifo)->fifo_prev = req;
+}
+
+/**
+ * 将请求项从所在 FIFO 中摘除（不在 FIFO 中时不做处理）
+ * @param dev 指定块设备指针
+ * @param req 请求项
+*/
+static inline void fifo_remove(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request ** fifo = dev->fifo + req->cmd;
+
+	if (!req->fifo_next)
+		return;
+	if (req->fifo_next == req)
+		*fifo = NULL;
+	else {
+		req->fifo_prev->fifo_next = req->fifo_next;
+		req->fifo_next->fifo_prev = req->fifo_prev;
+		if (*fifo == req)
+			*fifo = req->fifo_next;
+	}
+	req->fifo_prev = req->fifo_next = NULL;
+}
+
+/**
+ * 请求结束时由 end_request 调用（此时队首已指向下一请求）：将请求项从 FIFO 中摘除并放回空闲链表；
+ * 死线调度时若有请求已超时，把最早超时的请求（读优先）移到队首，作为下一个处理的请求；请求不能越过排在它前面的刷新请求
+ * @param dev 指定块设备指针
+ * @param req 已结束的请求项
+*/
+void release_request(struct blk_dev_struct * dev, struct request * req)
+{
+	struct request * tmp;
+	int i;
+
+	fifo_remove(dev,req);
+	req->next = dev->free_request;
+	dev->free_request = req;
+	dev->nr_free++;
+	wake_up(&dev->wait_for_request);			// 唤醒等待本设备请求项的进程
+	if (dev->sched != SCHED_DEADLINE || !dev->current_request)
+		return;
+	for (i=READ ; i<=WRITE ; i++)
+		if ((req = dev->fifo[i]) && req->expires - jiffies <= 0)
+			break;
+	if (i > WRITE || req == dev->current_request)
+		return;
+	for (tmp = dev->current_request ; tmp->next != req ; tmp = tmp->next)
+		if (tmp->flags & REQ_FLUSH)
+			return;
+	if (tmp->flags & REQ_FLUSH)
+		return;
+	tmp->next = req->next;
+	req->next = dev->current_request;
+	dev->current_request = req;
+}
+
 /**
  * 向链表中添加请求项
+ * 队列为空时塞住队列，等下一个时钟滴答或有进程等待缓冲块时再开始处理，期间提交的请求仍可合并与排序；
+ * 刷新请求排在队尾，之后的请求只能排在最后一个刷新请求之后
  * @param dev 指定块设备指针
  * @param req 请求结构信息
 */
 static void add_request(struct blk_dev_struct * dev, struct request * req)
 {
-	struct request * tmp;
+	struct request * tmp, * bar;
 
 	req->next = NULL;
 	cli(); 										// 禁止中断
 	if (req->bh)
 		req->bh->b_dirt = 0; 					// 复位缓冲区 脏标志
-	// 当前没请求时，直接将 req 置为当前请求
+	fifo_add(dev,req);
+	// 当前没请求时，将 req 置为当前请求并塞住队列
 	if (!(tmp = dev->current_request)) {
 		dev->current_request = req;
+		dev->plugged = 1;
+		if (!unplug_timer_on) {
+			unplug_timer_on = 1;
+			add_timer(1,&unplug_timeout);		// add_timer 返回时已开启中断
+		}
 		sti(); 									// 开启中断
-		(dev->request_fn)(); 					// 直接执行请求
 		return;
 	}
-	// 已有请求项时，遍历所有请求使用电梯算法获取最优位置，然后插入请求
-	for ( ; tmp->next ; tmp=tmp->next)
+	// 刷新请求直接排在队尾
+	if (req->flags & REQ_FLUSH) {
+		while (tmp->next)
+			tmp = tmp->next;
+		tmp->next = req;
+		sti();
+		return;
+	}
+	// 新请求不能排到刷新请求前面：从最后一个刷新请求开始查找位置
+	for (bar = NULL ; tmp ; tmp = tmp->next)
+		if (tmp->flags & REQ_FLUSH)
+			bar = tmp;
+	tmp = bar ? bar : dev->current_request;
+	// 队列被塞住时队首请求尚未开始处理，新请求可以排到它前面
+	if (!bar && dev->plugged && (IO_CLASS(req) < IO_CLASS(tmp) ||
+	    (IO_CLASS(req) == IO_CLASS(tmp) && IN_ORDER(req,tmp)))) {
+		req->next = tmp;
+		dev->current_request = req;
+		sti();
+		return;
+	}
+	// 已有请求项时，按 I/O 优先级类别分段：请求排在同类别及更高类别的请求之后、较低类别的请求之前，
+	// 段内遍历请求使用电梯算法获取最优位置，然后插入请求
+	for ( ; tmp->next ; tmp=tmp->next) {
+		if (IO_CLASS(tmp->next) > IO_CLASS(req))
+			break;
+		if (IO_CLASS(tmp->next) < IO_CLASS(req))
+			continue;
 		if ((IN_ORDER(tmp,req) ||
 		    !IN_ORDER(tmp,tmp->next)) &&
 		    IN_ORDER(req,tmp->next))
 			break;
+	}
 	req->next=tmp->next;
 	tmp->next=req;
 	sti(); // 开启中断
 }
 
+/**
+ * 尝试将缓冲块合并到队列中已有的请求：同一设备、同一命令、同一 I/O 优先级类别且扇区相邻时，接在请求之后或之前（刷新请求不参与合并）；
+ * 队首请求可能正在被驱动程序处理，除非队列被塞住，否则不参与合并；
+ * 也不能合并到刷新请求之前的请求中，否则该写操作可能在刷新之前完成。调用时需已关中断
+ * @param dev 指定块设备指针
+ * @param rw 读写命令
+ * @param bh 已上锁的缓冲块
+ * @return 合并成功返回 1，否则返回 0
+*/
+static int merge_request(struct blk_dev_struct * dev, int rw, struct buffer_head * bh)
+{
+	struct request * req, * tmp;
+	unsigned long sector = bh->b_blocknr<<1;
+
+	if (!(req = dev->current_request))
+		return 0;
+	if (!dev->plugged)
+		req = req->next;
+	for (tmp = req ; tmp ; tmp = tmp->next)		// 只在最后一个刷新请求之后查找
+		if (tmp->flags & REQ_FLUSH)
+			req = tmp->next;
+	for ( ; req ; req = req->next) {
+		if (req->dev != bh->b_dev || req->cmd != rw || !req->bh || req->flags ||
+		    IO_CLASS(req) != IOPRIO_CLASS(current->ioprio) ||
+		    req->nr_sectors + 2 > MAX_SECTORS)
+			continue;
+		if (req->sector + req->nr_sectors == sector) {		// 接在请求之后
+			req->bhtail->b_reqnext = bh;
+			req->bhtail = bh;
+		} else if (req->sector == sector + 2) {				// 接在请求之前
+			bh->b_reqnext = req->bh;
+			req->bh = bh;
+			req->buffer = bh->b_data;
+			req->sector = sector;
+		} else
+			continue;
+		req->nr_sectors += 2;
+		bh->b_dirt = 0; 							// 复位缓冲区 脏标志
+		return 1;
+	}
+	return 0;
+}
+
 /**
  * 创建块设备读写请求并插入请求队列
  * @param major 设备号
@@ -100,6 +293,7 @@ static void add_request(struct blk_dev_struct * dev, struct request * req)
 */
 static void make_request(int major,int rw, struct buffer_head * bh)
 {
+	struct blk_dev_struct * dev;
 	struct request * req;
 	int rw_ahead;
 
@@ -113,6 +307,7 @@ static void make_request(int major,int rw, struct buffer_head * bh)
 		else
 			rw = WRITE; 		// 设置写命令
 	}
+	dev = major+blk_dev;
 	if (rw!=READ && rw!=WRITE)	// 命令非读写时报错，死机
 		panic("Bad block dev command, must be R/W/RA/WA");
 	lock_buffer(bh); 			// 对指定缓冲上锁
@@ -121,34 +316,44 @@ static void make_request(int major,int rw, struct buffer_head * bh)
 		unlock_buffer(bh);
 		return;
 	}
+	bh->b_reqnext = NULL;
 repeat:
-	if (rw == READ)				// 读请求从末尾开始搜索空位的请求
-		req = request+NR_REQUEST;
-	else						// 写请求则是从 2/3 处开始搜索					
-		req = request+((NR_REQUEST*2)/3);
-	while (--req >= request)	// 查找请求数组中空闲项
-		if (req->dev<0)
-			break;
-	// 没空闲项时，则阻塞当前进程直到存在空闲项时被唤醒
-	if (req < request) {
+	cli();
+	// 能与队列中已有请求合并时，不再占用新的请求项
+	if (merge_request(dev,rw,bh)) {
+		sti();
+		return;
+	}
+	// 从本设备的空闲请求项中取一项，写请求要为读请求保留 1/3 的请求项
+	if (!(req = dev->free_request) ||
+	    (rw == WRITE && dev->nr_free <= dev->nr_requests/3)) {
 		if (rw_ahead) { 		// 预读写命令直接返回
+			sti();
 			unlock_buffer(bh);
 			return;
 		}
-		sleep_on(&wait_for_request);
+		// 没空闲项时，则阻塞当前进程直到本设备有请求项被释放
+		sleep_on(&dev->wait_for_request);
+		sti();
 		goto repeat;
 	}
+	dev->free_request = req->next;
+	dev->nr_free--;
+	sti();
 	// 创建请求信息，并添加到请求队列中去
 	req->dev = bh->b_dev;
 	req->cmd = rw;
+	req->flags = 0;
 	req->errors=0;
 	req->sector = bh->b_blocknr<<1;
 	req->nr_sectors = 2;
 	req->buffer = bh->b_data;
 	req->waiting = NULL;
 	req->bh = bh;
+	req->bhtail = bh;
+	req->ioprio = current->ioprio;
 	req->next = NULL;
-	add_request(major+blk_dev,req);
+	add_request(dev,req);
 }
 
 /**
@@ -169,17 +374,119 @@ void ll_rw_block(int rw, struct buffer_head * bh)
 	make_request(major,rw,bh);
 }
 
+/**
+ * 让设备把写缓存中的数据写到盘片上：提交一个排在已提交请求之后的刷新请求，并等待其完成；
+ * 设备没有写缓存（驱动程序不处理刷新请求）时直接返回
+ * @param dev 设备号
+*/
+void ll_rw_flush(int dev)
+{
+	struct blk_dev_struct * bdev;
+	struct request * req;
+	unsigned int major;
+
+	if ((major=MAJOR(dev)) >= NR_BLK_DEV || !(bdev = blk_dev+major)->flush)
+		return;
+repeat:
+	cli();
+	if (!(req = bdev->free_request)) {
+		sleep_on(&bdev->wait_for_request);
+		sti();
+		goto repeat;
+	}
+	bdev->free_request = req->next;
+	bdev->nr_free--;
+	sti();
+	req->dev = dev;
+	req->cmd = WRITE;
+	req->flags = REQ_FLUSH;
+	req->errors = 0;
+	req->sector = 0;
+	req->nr_sectors = 0;
+	req->buffer = NULL;
+	req->bh = req->bhtail = NULL;
+	req->ioprio = current->ioprio;
+	// 请求项结束后即被放回空闲链表，因此不能在请求项上等待：先置为不可中断睡眠状态，由 end_request 唤醒
+	cli();
+	current->state = TASK_UNINTERRUPTIBLE;
+	req->waiting = current;
+	add_request(bdev,req);
+	unplug_devices();
+	schedule();
+}
+
+/**
+ * 块设备调度算法设置系统调用
+ * func 为 0 时把 major 设备的调度算法设置为 data（SCHED_ELEVATOR 或 SCHED_DEADLINE），为 1 时读取调度算法到 data 所指位置；
+ * func 为 2n+2 时读取第 n 个参数到 data 所指位置，为 2n+3 时把第 n 个参数设置为 data
+ * 参数依次为：读请求超时时间、写请求超时时间（滴答）
+ * @param major 主设备号
+ * @param func 功能号
+ * @param data 参数值或用户空间地址
+ * @return 成功返回 0，否则返回出错号
+*/
+int sys_iosched(int major, int func, long data)
+{
+	struct blk_dev_struct * dev;
+	int i;
+
+	if (major < 0 || major >= NR_BLK_DEV || !(dev = blk_dev+major)->request_fn)
+		return -ENODEV;
+	if (func == 1 || (func >= 2 && !(func & 1))) {
+		if (func == 1)
+			i = dev->sched;
+		else if ((i = (func-2) >> 1) <= WRITE)
+			i = dev->expire[i];
+		else
+			return -EINVAL;
+		verify_area((void *) data,4);
+		put_fs_long(i,(unsigned long *) data);
+		return 0;
+	}
+	if (!suser())
+		return -EPERM;
+	if (!func) {
+		if (data != SCHED_ELEVATOR && data != SCHED_DEADLINE)
+			return -EINVAL;
+		dev->sched = data;
+		return 0;
+	}
+	if (func < 3 || (i = (func-3) >> 1) > WRITE || data <= 0)	// 负的功能号也会走到这里
+		return -EINVAL;
+	dev->expire[i] = data;
+	return 0;
+}
+
 /**
  * 块设备初始化程序
- * 
+ * 申请一页内存，按 nr_requests[] 为各块设备分出各自的请求项池
 */
 void blk_dev_init(void)
 {
-	int i;
+	struct request * req;
+	int i, j;
 
-	// 初始化块设备请求数组队列，将所有全设置为 未请求，下一请求置空
-	for (i=0 ; i<NR_REQUEST ; i++) {
-		request[i].dev = -1; 	// 初始化空闲请求项 dev 初始值位 -1 
-		request[i].next = NULL; // 初始化请求下一项为 NULL
+	for (i=j=0 ; i<NR_BLK_DEV ; i++)
+		j += nr_requests[i];
+	if (j*sizeof(struct request) > 4096)
+		panic("Too many block requests");
+	if (!(req = (struct request *) get_free_page()))
+		panic("Unable to get a page for block requests");
+	for (i=0 ; i<NR_BLK_DEV ; i++) {
+		blk_dev[i].free_request = NULL;
+		blk_dev[i].nr_free = blk_dev[i].nr_requests = nr_requests[i];
+		blk_dev[i].wait_for_request = NULL;
+		blk_dev[i].plugged = 0;
+		blk_dev[i].sched = default_sched[i];
+		blk_dev[i].expire[READ] = HZ/2;			// 读请求默认 0.5 秒超时
+		blk_dev[i].expire[WRITE] = 5*HZ;		// 写请求默认 5 秒超时
+		blk_dev[i].fifo[READ] = blk_dev[i].fifo[WRITE] = NULL;
+		blk_dev[i].flush = 0;
+		// 初始化请求项为 未请求，并放入该设备的空闲请求项链表
+		for (j=0 ; j<nr_requests[i] ; j++,req++) {
+			req->dev = -1; 	// 初始化空闲请求项 dev 初始值位 -1 
+			req->next = blk_dev[i].free_request;
+			blk_dev[i].free_request = req;
+		}
 	}
 }
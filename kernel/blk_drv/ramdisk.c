@@ -20,6 +20,19 @@
 char	*rd_start;	// 虚拟盘在内存中的起始位置
 int	rd_length = 0;	// 虚拟盘所在内存大小（字节）
 
+/*
+ * Zero-copy buffers: blocks of the ram disk are not copied into the
+ * buffer cache. get_hash_table() hands out one of the buffer heads
+ * below with b_data pointing straight into the ram disk, always up to
+ * date; changes made through it are already "written", so they are
+ * never marked dirty. The heads live in one page after the ram disk and
+ * are reused, round robin, once nobody holds them.
+ */
+struct buffer_head * rd_buffers = NULL;		// 虚拟盘缓冲头数组
+int nr_rd_buffers = 0;						// 虚拟盘缓冲头个数
+static int rd_clock = 0;					// 下一次从此处开始查找可重用的缓冲头
+static struct task_struct * rd_wait = NULL;	// 等待虚拟盘缓冲头空闲的进程
+
 /**
  * 执行虚拟盘读写操作函数；
  * 程序结构与与 do_hd_request() 类似
@@ -37,28 +50,91 @@ void do_rd_request(void)
 		end_request(0);
 		goto repeat;
 	}
-	// 进行写操作时，请求项的缓冲区内容复制到 addr 处，长度为length
-	if (CURRENT-> cmd == WRITE) {
-		(void ) memcpy(addr,
-			      CURRENT->buffer,
-			      len);
-	// 进行读操作时，与写操作相反，是将内存中的内容复制到缓冲区
-	} else if (CURRENT->cmd == READ) {
-		(void) memcpy(CURRENT->buffer, 
-			      addr,
-			      len);
-	// 命令只能为读写命令
-	} else
-		panic("unknown ramdisk-command");
+	// 合并请求中各缓冲块的数据区并不连续，因此逐个扇区复制；直接映射的缓冲块无需复制
+	do {
+		if (CURRENT->buffer == addr) {
+			addr += 512;
+			continue;
+		}
+		// 进行写操作时，请求项的缓冲区内容复制到 addr 处
+		if (CURRENT-> cmd == WRITE) {
+			(void ) memcpy(addr,
+				      CURRENT->buffer,
+				      512);
+		// 进行读操作时，与写操作相反，是将内存中的内容复制到缓冲区
+		} else if (CURRENT->cmd == READ) {
+			(void) memcpy(CURRENT->buffer, 
+				      addr,
+				      512);
+		// 命令只能为读写命令
+		} else
+			panic("unknown ramdisk-command");
+		addr += 512;
+	} while (next_sector());
 	//执行完毕时，置更新标志，继续处理下一请求项
 	end_request(1);
 	goto repeat;
 }
 
+/**
+ * 取虚拟盘块对应的直接映射缓冲块（数据区就是虚拟盘内存），由 get_hash_table 调用；
+ * 所有缓冲头都被占用时睡眠等待
+ * @param dev 设备号
+ * @param block 块号
+ * @return 缓冲头指针，设备或块号不属于虚拟盘时返回 NULL
+*/
+struct buffer_head * rd_getblk(int dev,int block)
+{
+	struct buffer_head * bh;
+	int i;
+
+	if (!nr_rd_buffers || MINOR(dev) != 1 ||
+	    block < 0 || block >= (rd_length >> BLOCK_SIZE_BITS))
+		return NULL;
+repeat:
+	for (bh = rd_buffers ; bh < rd_buffers + nr_rd_buffers ; bh++)
+		if (bh->b_dev == dev && bh->b_blocknr == block) {
+			bh->b_count++;
+			bh->b_uptodate = 1;
+			return bh;
+		}
+	// 从上次的位置起找一个无人使用的缓冲头
+	for (i=0 ; i<nr_rd_buffers ; i++) {
+		bh = rd_buffers + rd_clock;
+		if (++rd_clock >= nr_rd_buffers)
+			rd_clock = 0;
+		if (!bh->b_count)
+			break;
+	}
+	if (bh->b_count) {
+		sleep_on(&rd_wait);
+		goto repeat;
+	}
+	bh->b_data = rd_start + (block << BLOCK_SIZE_BITS);
+	bh->b_dev = dev;
+	bh->b_blocknr = block;
+	bh->b_count = 1;
+	bh->b_uptodate = 1;
+	bh->b_dirt = 0;
+	return bh;
+}
+
+/**
+ * 释放直接映射的缓冲块，由 brelse 调用
+ * @param bh 缓冲头指针
+*/
+void rd_brelse(struct buffer_head * bh)
+{
+	if (!(bh->b_count--))
+		panic("Trying to free free ramdisk buffer");
+	wake_up(&rd_wait);
+}
+
 /**
  * 虚拟盘初始化函数
  * @param mem_start 虚拟盘内存起始地址
  * @param length 虚拟盘内存长度
+ * @return 占用的内存大小（虚拟盘之后还有一页存放直接映射的缓冲头）
 */
 long rd_init(long mem_start, int length)
 {
@@ -68,14 +144,128 @@ long rd_init(long mem_start, int length)
 	blk_dev[MAJOR_NR].request_fn = DEVICE_REQUEST;	// 设置虚拟盘请求操作函数
 	rd_start = (char *) mem_start;					// 设置虚拟盘内存起始地址（与主内存地址一致）
 	rd_length = length;								// 初始化虚拟盘长度
-	cp = rd_start;									// 初始化内存虚拟盘区域的内存（对齐清零）
-	for (i=0; i < length; i++)
+	cp = rd_start;									// 初始化内存虚拟盘区域与缓冲头页的内存（对齐清零）
+	for (i=0; i < length + PAGE_SIZE; i++)
 		*cp++ = '\0';
-	return(length);									// 返回虚拟盘区域大小
+	rd_buffers = (struct buffer_head *) (rd_start + length);
+	nr_rd_buffers = PAGE_SIZE / sizeof(struct buffer_head);
+	for (i=0 ; i < nr_rd_buffers ; i++)				// 直接映射的缓冲头从不进入 LRU 表
+		rd_buffers[i].b_list = BUF_NONE;
+	return(length + PAGE_SIZE);						// 返回虚拟盘区域大小
+}
+
+/*
+ * State of the compressed image reader: z_getc() returns the next byte
+ * of the stream, moving to the next floppy block (and keeping the
+ * read-ahead going) when the current one is used up.
+ */
+static struct buffer_head * z_bh; 		// 当前读的压缩数据块
+static int z_block; 					// 当前块号
+static int z_pos; 						// 当前块中的读位置
+static unsigned long z_left; 			// 还未读的压缩数据字节数
+
+/**
+ * 读入压缩数据流的下一字节
+ * @return 字节值，数据已读完或读盘出错时返回 -1
+*/
+static int z_getc(void)
+{
+	if (!z_left)
+		return -1;
+	if (z_pos >= BLOCK_SIZE) {
+		brelse(z_bh);
+		z_block++;
+		// 每读 16 块提交一次其后最多 32 块的异步预读，使软盘读与解压重叠进行
+		if (!(z_block & 15))
+			prefetch_range(ROOT_DEV, z_block+1,
+				z_left > 32*BLOCK_SIZE ? 32 : (z_left-1) >> BLOCK_SIZE_BITS);
+		if (!(z_bh = bread(ROOT_DEV, z_block))) {
+			printk("I/O error on block %d, aborting load\n", z_block);
+			z_left = 0;
+			return -1;
+		}
+		z_pos = 0;
+	}
+	z_left--;
+	return (unsigned char) z_bh->b_data[z_pos++];
+}
+
+/**
+ * 读入 LZ4 长度的扩展部分（每个 255 字节表示还有后续）
+ * @param n 令牌中的 4 位长度
+ * @return 完整长度，出错时返回 -1
+*/
+static long z_length(long n)
+{
+	int c;
+
+	if (n == 15)
+		do {
+			if ((c = z_getc()) < 0)
+				return -1;
+			n += c;
+		} while (c == 255);
+	return n;
+}
+
+/**
+ * 把从第 256 块开始、以 rd_zheader 开头的压缩映像边读边解压到虚拟盘
+ * @param bh 第 256 块的缓冲块（本函数负责释放）
+ * @return 成功返回 1，否则返回 0
+*/
+static int rd_unzip(struct buffer_head * bh)
+{
+	struct rd_zheader * z = (struct rd_zheader *) bh->b_data;
+	char * out = rd_start, * end, * p;
+	long n, off;
+	int t, c;
+
+	if (z->z_size > rd_length) {
+		printk("Ram disk image too big!  (%d bytes, %d avail)\n",
+			z->z_size, rd_length);
+		brelse(bh);
+		return 0;
+	}
+	printk("Loading %d bytes (%d compressed) into ram disk... ",
+		z->z_size, z->z_csize);
+	end = rd_start + z->z_size;
+	z_bh = bh;
+	z_block = 256;
+	z_pos = sizeof(struct rd_zheader);
+	z_left = z->z_csize;
+	prefetch_range(ROOT_DEV, 257, z_left > 32*BLOCK_SIZE ? 32 : z_left >> BLOCK_SIZE_BITS);
+	// 每个序列：令牌（高 4 位为文字长度，低 4 位为匹配长度 - 4），文字，2 字节偏移，匹配
+	while (out < end) {
+		if ((t = z_getc()) < 0 || (n = z_length(t >> 4)) < 0 || n > end - out)
+			goto bad;
+		while (n--) {
+			if ((c = z_getc()) < 0)
+				goto bad;
+			*out++ = c;
+		}
+		if (out == end)
+			break;
+		if ((c = z_getc()) < 0 || (off = z_getc()) < 0)
+			goto bad;
+		off = c | (off << 8);
+		if (!off || off > out - rd_start ||
+		    (n = z_length(t & 15)) < 0 || (n += 4) > end - out)
+			goto bad;
+		for (p = out - off ; n-- ; )
+			*out++ = *p++;
+	}
+	brelse(z_bh);
+	printk("done \n");
+	return 1;
+bad:
+	brelse(z_bh);
+	printk("bad compressed ram disk image\n");
+	return 0;
 }
 
 /**
  * 加载根文件系统到 Ramdisk
+ * 第 256 块以 rd_zheader 开头时为压缩映像，否则为原始映像
 */
 void rd_load(void)
 {
@@ -92,6 +282,19 @@ void rd_load(void)
 		(int) rd_start);
 	if (MAJOR(ROOT_DEV) != 2)							// 根文件所在设备不在软盘时退出
 		return;
+	bh = bread(ROOT_DEV,block);
+	if (!bh) {
+		printk("Disk error while looking for ramdisk!\n");
+		return;
+	}
+	if (((struct rd_zheader *) bh->b_data)->z_magic == RD_ZMAGIC) {
+		// 压缩映像解压后，还要确认其中确实是 minix 文件系统
+		if (rd_unzip(bh) &&
+		    ((struct d_super_block *) (rd_start + BLOCK_SIZE))->s_magic == SUPER_MAGIC)
+			ROOT_DEV=0x0101;
+		return;
+	}
+	brelse(bh);
 	bh = breada(ROOT_DEV,block+1,block,block+2,-1); 	// 读取 256+1，256，256+2 上的块
 	if (!bh) {
 		printk("Disk error while looking for ramdisk!\n");
@@ -114,10 +317,10 @@ void rd_load(void)
 	cp = rd_start;
 	// 循环将所有系统块全部加载置缓冲区
 	while (nblocks) {
-		if (nblocks > 2) 
-			bh = breada(ROOT_DEV, block, block+1, block+2, -1);
-		else
-			bh = bread(ROOT_DEV, block);
+		// 每读 16 块提交一次其后最多 32 块的异步预读（已在缓存或正在读的块会被跳过），使软盘读与复制重叠进行
+		if (!((i-1) & 15))
+			prefetch_range(ROOT_DEV, block+1, nblocks > 32 ? 32 : nblocks-1);
+		bh = bread(ROOT_DEV, block);
 		if (!bh) {
 			printk("I/O error on block %d, aborting load\n", 
 				block);
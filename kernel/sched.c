@@ -10,6 +10,8 @@
  * call functions (type getpid(), which just extracts a field from
  * current-task
  */
+#include <errno.h>
+
 #include <linux/sched.h>
 #include <linux/kernel.h>
 #include <linux/sys.h>
@@ -40,7 +42,7 @@ void show_task(int nr,struct task_struct * p)
 }
 
 /**
- * 展示当前所有任务的进程信息
+ * 展示当前所有任务的进程信息以及高速缓冲统计
 */
 void show_stat(void)
 {
@@ -49,6 +51,7 @@ void show_stat(void)
 	for (i=0;i<NR_TASKS;i++)
 		if (task[i])
 			show_task(i,task[i]);
+	show_buffer_stat(); // 同时展示高速缓冲区各类块的命中率
 }
 
 #define LATCH (1193180/HZ) // 设置定时芯片 8253 的计数初值
@@ -509,6 +512,41 @@ int sys_nice(long increment)
 	return 0;
 }
 
+/**
+ * 设置或读取进程的 I/O 优先级
+ * 设置其他进程需与其用户相同，设置实时类别需要超级用户权限
+ * @param pid 进程号，为 0 时表示当前进程
+ * @param prio 新的 I/O 优先级 IOPRIO(class,level)，小于 0 时只读取
+ * @return 成功返回进程原来的 I/O 优先级，否则返回出错号
+*/
+int sys_ioprio(int pid, int prio)
+{
+	struct task_struct ** p, * t = current;
+	int old;
+
+	// 查找指定进程
+	if (pid) {
+		for (p = &LAST_TASK ; p > &FIRST_TASK ; --p)
+			if (*p && (*p)->pid == pid)
+				break;
+		if (p <= &FIRST_TASK)
+			return -ESRCH;
+		t = *p;
+	}
+	old = t->ioprio;
+	if (prio < 0)
+		return old;
+	if (IOPRIO_CLASS(prio) < IOPRIO_CLASS_RT || IOPRIO_CLASS(prio) > IOPRIO_CLASS_IDLE ||
+	    IOPRIO_LEVEL(prio) >= IOPRIO_NR_LEVELS)
+		return -EINVAL;
+	if (t->euid != current->euid && !suser())
+		return -EPERM;
+	if (IOPRIO_CLASS(prio) == IOPRIO_CLASS_RT && !suser())
+		return -EPERM;
+	t->ioprio = prio;
+	return old;
+}
+
 /**
  * 调度程序初始化子程序
 */
@@ -482,6 +482,12 @@ void do_no_page(unsigned long error_code,unsigned long address)
 	for (i=0 ; i<4 ; block++,i++)
 		nr[i] = bmap(current->executable,block); // 获取设备上对应逻辑块
 	bread_page(page,current->executable->i_dev,nr); // 读设备上一个页面的数据（4个逻辑块）到指定物理地址 page 处
+	// 后面还有代码/数据时，异步预读下一页面的 4 个逻辑块，让磁盘读与进程运行重叠进行
+	if (tmp + 4096 < current->end_data) {
+		for (i=0 ; i<4 ; block++,i++)
+			nr[i] = bmap(current->executable,block);
+		prefetch_blocks(current->executable->i_dev,nr,4);
+	}
 	// 将超过 end_data 部分的空间清空
 	i = tmp + 4096 - current->end_data;
 	tmp = page + 4096;
@@ -0,0 +1,200 @@
+/*
+ *  linux/tools/rdcomp.c
+ */
+
+/*
+ * This compresses a ram disk image (a raw minix file system) for
+ * rd_load(). The result is written to stdout: a struct rd_zheader
+ * followed by the data in LZ4 block format, padded to a whole number of
+ * 1kB blocks. It goes on the boot floppy at block 256, exactly where an
+ * uncompressed image would, e.g.
+ *
+ *	tools/rdcomp rootimage > rootimage.z
+ *	dd bs=1024 seek=256 if=rootimage.z of=/dev/PS0
+ *
+ * The compressor is the simple greedy one: a hash of the next 4 bytes
+ * finds the last place they occurred, and the match is extended as far
+ * as it goes. It's not the best ratio possible, but decompression in
+ * the kernel is a trivial loop and a file system image compresses well
+ * anyway (most of it is usually zeroes).
+ */
+
+/**
+ * 该程序压缩虚拟盘映像（原始 minix 文件系统）供 rd_load() 使用
+ * 结果写到标准输出：rd_zheader 头部，随后是 LZ4 块格式的压缩数据，并补齐到 1KB 的整数倍；
+ * 与未压缩映像一样放在启动软盘的第 256 块处
+*/
+
+#include <stdio.h>	/* fprintf */
+#include <string.h>
+#include <stdlib.h>	/* contains exit */
+#include <stdint.h>
+#include <sys/types.h>	/* unistd.h needs this */
+#include <sys/stat.h>
+#include <unistd.h>	/* contains read/write */
+#include <fcntl.h>
+
+/*
+ * This is the kernel's struct rd_zheader (include/linux/fs.h), but it
+ * can't be included from there: this runs on the host, where the
+ * <linux/fs.h> found is the host's own, and a long may be 64 bits. The
+ * header is three 32-bit little-endian words on disk, whatever the host.
+ */
+#define RD_ZMAGIC 0x5a44524c	// 与 include/linux/fs.h 中的定义一致
+#define ZHDR_SIZE 12		// 磁盘上头部的字节数
+
+struct rd_zheader {
+	uint32_t z_magic;
+	uint32_t z_size;
+	uint32_t z_csize;
+};
+
+// 头部大小不是 12 字节时编译出错
+typedef char zhdr_size_check[sizeof(struct rd_zheader) == ZHDR_SIZE ? 1 : -1];
+
+#define HASH_BITS 12         // hash 表项数所占比特位数
+#define MIN_MATCH 4          // 最短匹配长度
+#define MAX_OFFSET 65535     // 匹配的最大回退距离
+#define LAST_LITERALS 5      // 最后 5 个字节必须是文字
+#define MF_LIMIT 12          // 最后一个匹配至少要在结尾前 12 字节开始
+
+static long htab[1 << HASH_BITS];   // 每个 hash 值最后出现的位置
+static unsigned char * out;         // 输出缓冲区
+static long olen = 0;               // 输出字节数
+
+/**
+ * 显示出错信息，并终止程序
+ * @param str 出错信息指针
+*/
+void die(char * str)
+{
+	fprintf(stderr,"%s\n",str);
+	exit(1);
+}
+
+/**
+ * 显示程序使用方法，并退出
+*/
+void usage(void)
+{
+	die("Usage: rdcomp image [> compressed image]");
+}
+
+/**
+ * 以小端字节序存放一个 32 位整数
+ * @param p 存放位置
+ * @param v 整数值
+*/
+static void put32(unsigned char * p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/**
+ * 计算 p 处 4 个字节的 hash 值
+*/
+static int hash(unsigned char * p)
+{
+	unsigned int v = p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int) p[3] << 24);
+
+	return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/**
+ * 输出长度的扩展部分：每个 255 表示还有后续
+ * @param n 令牌中放不下的长度（已减去 15）
+*/
+static void put_length(long n)
+{
+	for ( ; n >= 255 ; n -= 255)
+		out[olen++] = 255;
+	out[olen++] = n;
+}
+
+/**
+ * 输出一个序列：令牌、文字，以及（mlen 不为 0 时）偏移与匹配长度
+ * @param lit 文字起始位置
+ * @param nlit 文字长度
+ * @param off 匹配的回退距离
+ * @param mlen 匹配长度，0 表示最后一个只有文字的序列
+*/
+static void emit(unsigned char * lit, long nlit, long off, long mlen)
+{
+	int token;
+
+	token = (nlit < 15 ? nlit : 15) << 4;
+	if (mlen)
+		token |= (mlen - MIN_MATCH < 15) ? mlen - MIN_MATCH : 15;
+	out[olen++] = token;
+	if (nlit >= 15)
+		put_length(nlit - 15);
+	memcpy(out + olen, lit, nlit);
+	olen += nlit;
+	if (!mlen)
+		return;
+	out[olen++] = off & 0xff;
+	out[olen++] = off >> 8;
+	if (mlen - MIN_MATCH >= 15)
+		put_length(mlen - MIN_MATCH - 15);
+}
+
+int main(int argc, char ** argv)
+{
+	int id;
+	long n, i, ref, len, anchor, h;
+	unsigned char * in;
+	struct stat sb;
+	struct rd_zheader z;
+	unsigned char zh[ZHDR_SIZE];
+	char pad[1024];
+
+	if (argc != 2)
+		usage();
+	// 读入整个映像
+	if ((id=open(argv[1],O_RDONLY,0))<0 || fstat(id,&sb))
+		die("Unable to open image");
+	n = sb.st_size;
+	if (!(in = malloc(n+1)) || !(out = malloc(n + n/255 + 16)))
+		die("Out of memory");
+	if (read(id,in,n) != n)
+		die("Unable to read image");
+	close(id);
+	for (i=0 ; i < (1 << HASH_BITS) ; i++)
+		htab[i] = -1;
+	// 贪心压缩：找到前面出现过的相同 4 字节时，尽量延长匹配
+	for (i = anchor = 0 ; i + MF_LIMIT <= n ; ) {
+		h = hash(in+i);
+		ref = htab[h];
+		htab[h] = i;
+		if (ref < 0 || i - ref > MAX_OFFSET || memcmp(in+ref,in+i,MIN_MATCH)) {
+			i++;
+			continue;
+		}
+		for (len = MIN_MATCH ; i + len < n - LAST_LITERALS &&
+		     in[ref+len] == in[i+len] ; len++)
+			/* nothing */ ;
+		emit(in+anchor,i-anchor,i-ref,len);
+		i += len;
+		anchor = i;
+	}
+	emit(in+anchor,n-anchor,0,0);
+	// 写出头部与压缩数据，并补齐到 1KB 的整数倍
+	z.z_magic = RD_ZMAGIC;
+	z.z_size = n;
+	z.z_csize = olen;
+	put32(zh,z.z_magic);
+	put32(zh+4,z.z_size);
+	put32(zh+8,z.z_csize);
+	if (write(1,zh,ZHDR_SIZE) != ZHDR_SIZE || write(1,out,olen) != olen)
+		die("Write call failed");
+	memset(pad,0,sizeof pad);
+	i = (ZHDR_SIZE + olen) % sizeof pad;
+	if (i && write(1,pad,sizeof pad - i) != sizeof pad - i)
+		die("Write call failed");
+	fprintf(stderr,"Ram disk image %ld bytes, compressed %ld bytes (%ld blocks).\n",
+		n, olen, (long) ((ZHDR_SIZE + olen + 1023) / 1024));
+	return(0);
+}